@@ -58,9 +58,9 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. memlib reserves it a segment at a time.
  */
-#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#define MAX_HEAP (1024*(1<<20))  /* 1 GB */
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
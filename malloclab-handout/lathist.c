@@ -0,0 +1,110 @@
+/*
+ * lathist.c - Timer calibration and quantiles for latency histograms
+ */
+#include <stdlib.h>
+#include "lathist.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#define CAL_PAIRS  (1 << 16)   /* empty timestamp pairs to measure overhead */
+#define CAL_NSECS  20000000    /* how long to count ticks against the clock */
+
+int lat_tsc = 0;
+uint64_t lat_ovhd = 0;
+static double ns_per_tick = 1.0;
+
+static uint64_t clock_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/*
+ * lat_init - Use the TSC if the CPU has rdtscp, and find how many
+ *     nanoseconds a tick is. The overhead subtracted from each latency
+ *     is the median cost of two back to back timestamps.
+ */
+const char *lat_init(void)
+{
+    lat_hist_t *h;
+    uint64_t c0, c1, t0, t1;
+    int i;
+
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned a, b, c, d;
+
+    if (__get_cpuid(0x80000001, &a, &b, &c, &d) && (d & (1u << 27)))
+        lat_tsc = 1;
+#endif
+    if (lat_tsc) {
+        c0 = clock_ns();
+        t0 = lat_now();
+        do {
+            c1 = clock_ns();
+        } while (c1 - c0 < CAL_NSECS);
+        t1 = lat_now();
+        ns_per_tick = (double)(c1 - c0) / (double)(t1 - t0);
+    }
+
+    if ((h = calloc(1, sizeof(lat_hist_t))) == NULL)
+        return lat_tsc ? "rdtscp" : "clock_gettime";
+    lat_ovhd = 0;
+    for (i = 0; i < CAL_PAIRS; i++) {
+        t0 = lat_now();
+        t1 = lat_now();
+        lat_add(h, t0, t1);
+    }
+    lat_ovhd = (uint64_t)(lat_quantile(h, 0.5) / ns_per_tick + 0.5);
+    free(h);
+    return lat_tsc ? "rdtscp" : "clock_gettime";
+}
+
+/*
+ * lat_quantile - The smallest latency that at least a q fraction of
+ *     the values in h do not exceed, rounded up to the top of its
+ *     bucket. q = 1 gives the exact maximum.
+ */
+double lat_quantile(const lat_hist_t *h, double q)
+{
+    uint64_t want, seen = 0, top;
+    int i, shift;
+
+    if (h->total == 0)
+        return 0;
+    want = (uint64_t)(q * h->total + 0.5);
+    if (want < 1)
+        want = 1;
+    if (want >= h->total)
+        return h->max * ns_per_tick;
+    for (i = 0; i < LAT_BUCKETS; i++)
+        if ((seen += h->count[i]) >= want)
+            break;
+    if (i < 2 * LAT_SUB)
+        top = i;
+    else {
+        shift = i / LAT_SUB - 1;
+        top = ((uint64_t)(i - shift * LAT_SUB) << shift) +
+            ((uint64_t)1 << shift) - 1;
+    }
+    if (top > h->max)
+        top = h->max;
+    return top * ns_per_tick;
+}
+
+/*
+ * lat_merge - Add the counts of from to to
+ */
+void lat_merge(lat_hist_t *to, const lat_hist_t *from)
+{
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++)
+        to->count[i] += from->count[i];
+    to->total += from->total;
+    if (from->max > to->max)
+        to->max = from->max;
+}
@@ -0,0 +1,70 @@
+/*
+ * lathist.h - Latency histograms for single allocator requests (mdriver -H)
+ *
+ * Requests are timed with rdtscp where the CPU has it and with
+ * clock_gettime otherwise. Latencies are binned HDR style: below 64
+ * ticks every value has its own bucket, and above that each power of
+ * two is split into 32 buckets, so any latency is known to within
+ * about 3% in a fixed amount of memory.
+ */
+#include <stdint.h>
+#include <time.h>
+
+#define LAT_SUB_BITS  5
+#define LAT_SUB       (1 << LAT_SUB_BITS)             /* buckets per octave */
+#define LAT_BUCKETS   ((65 - LAT_SUB_BITS) * LAT_SUB) /* for any 64-bit value */
+
+typedef struct {
+    uint64_t count[LAT_BUCKETS];
+    uint64_t total;  /* values added */
+    uint64_t max;    /* largest of them, exactly */
+} lat_hist_t;
+
+extern int lat_tsc;        /* set if lat_now reads the TSC */
+extern uint64_t lat_ovhd;  /* ticks a timestamp pair costs by itself */
+
+/* Pick and calibrate the timer; returns its name */
+const char *lat_init(void);
+
+/* Current time in ticks */
+static inline uint64_t lat_now(void)
+{
+    struct timespec t;
+
+#if defined(__i386__) || defined(__x86_64__)
+    if (lat_tsc) {
+        unsigned lo, hi, aux;
+        /* rdtscp waits for earlier instructions, lfence holds later ones */
+        __asm__ __volatile__("rdtscp; lfence"
+                             : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+        return ((uint64_t)hi << 32) | lo;
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Add the latency between timestamps t0 and t1, less the timer's own */
+static inline void lat_add(lat_hist_t *h, uint64_t t0, uint64_t t1)
+{
+    uint64_t v = t1 - t0;
+    int e, i;
+
+    v = (v > lat_ovhd) ? v - lat_ovhd : 0;
+    if (v < 2 * LAT_SUB)
+        i = (int)v;
+    else {
+        e = 63 - __builtin_clzll(v);
+        i = (e - LAT_SUB_BITS) * LAT_SUB + (int)(v >> (e - LAT_SUB_BITS));
+    }
+    h->count[i]++;
+    h->total++;
+    if (v > h->max)
+        h->max = v;
+}
+
+/* The q quantile (0 < q <= 1) of h in nanoseconds */
+double lat_quantile(const lat_hist_t *h, double q);
+
+/* Add the counts of from to to */
+void lat_merge(lat_hist_t *to, const lat_hist_t *from);
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,11 +15,26 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "mm.h"
+#include "mmreg.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "memkern.h"
+#include "tracefmt.h"
+#include "tstream.h"
+#include "lathist.h"
+#include "perfctr.h"
 #include "config.h"
 
 /**********************
@@ -29,6 +45,10 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define LAT_SAMPLES 100000 /* -H replays a trace until it has this many */
+
+/* How the results are written (--format) */
+enum {FMT_TEXT, FMT_JSON, FMT_CSV};
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -37,19 +57,23 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload; a node of a treap keyed by lo */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below lo */
+    struct range_t *right; /* ranges above lo */
+    unsigned prio;         /* heap order: a parent's prio is never larger */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+/* 
+ * Characterizes a single trace operation (allocator request): type,
+ * index for free() to use later, and byte size of alloc/realloc
+ * request. Shares its layout with a binary trace record, so a mapped
+ * trace file needs no conversion.
+ */
+enum {ALLOC = TRACE_ALLOC, FREE = TRACE_FREE, REALLOC = TRACE_REALLOC};
+typedef trace_rec_t traceop_t;
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -60,6 +84,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapped binary trace file that ops points into */
+    size_t map_len;      /* length of that mapping */
 } trace_t;
 
 /* 
@@ -81,16 +107,32 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    lat_hist_t *lat; /* with -H, latencies of each request type, or NULL */
+    double ctr[PC_NUM]; /* with -P, events in one replay; -1 if not counted */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Describes the build and the machine, for machine-readable results */
+typedef struct {
+    char date[32];        /* when the run ended, UTC, ISO 8601 */
+    struct utsname host;  /* node name, OS release and architecture */
+    char cpu[MAXLINE];    /* CPU model, if /proc/cpuinfo names it */
+    long cpus;            /* online CPUs */
+    const char *isa;      /* instruction set of the large-fill kernel */
+    const char *timer;    /* what fsecs times with */
+    const char *lat_timer;/* what -H times with, or NULL */
+    int counters;         /* set if -P counted events */
+} meta_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static mm_alloc_t *mm_cur = &mm_allocs[0]; /* the mm package being run */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
+static cpu_set_t run_cpus; /* CPUs we may use, before pin_cpu (-j) */
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -105,14 +147,16 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
+/* these functions manipulate the range set */
+static int add_range(range_t **ranges, char *lo, size_t size, 
+		     int tracenum, long opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_rep_trace(trace_t *trace, FILE *tracefile, char *path);
+static void read_bin_trace(trace_t *trace, int fd, char *path, size_t len);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -124,12 +168,32 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, lat_hist_t *lat);
+static void eval_mm_stream(char *path, int tracenum, range_t **ranges,
+			   stats_t *stats);
+static void eval_mm_parallel(trace_t **traces, int num_traces, int jobs,
+			     stats_t *stats);
+static void pin_cpu(void);
+static void eval_mt(trace_t **traces, stats_t *stats, int n, int maxthreads,
+		    int split);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void getmeta(meta_t *meta);
+static void printmatrix(int n, char **tracefiles, stats_t *libc_stats,
+			stats_t **all_stats, double (*all_perf)[3],
+			int *all_errors, int num_allocs);
+static void printjson(FILE *fp, meta_t *meta, char **tracefiles, int n,
+		      stats_t *libc_stats, stats_t **all_stats,
+		      double (*all_perf)[3], int *all_errors, int num_allocs);
+static void printcsv(FILE *fp, meta_t *meta, char **tracefiles, int n,
+		     stats_t *libc_stats, stats_t **all_stats,
+		     double (*all_perf)[3], int *all_errors, int num_allocs);
 static void usage(void);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(int tracenum, long opnum, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -141,15 +205,36 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
+    trace_t **traces = NULL;   /* every trace file, read once */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t **all_stats = NULL;/* the mm_stats of each package run */
+    double (*all_perf)[3] = NULL; /* util, thru and total of each perf index */
+    int *all_errors = NULL;    /* the errors of each package run */
+    int num_allocs, a;         /* how many packages are built in; which one */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
+    size_t map_min = 0;  /* If set, mm maps requests this big (set by -M) */
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int stream = 0;      /* If set, stream traces from disk (set by -s) */
+    int jobs = 1;        /* Traces checked at once (set by -j) */
+    int latency = 0;     /* If set, histogram request latencies (set by -H) */
+    int counters = 0;    /* If set, count hardware events (set by -P) */
+    int threads = 0;     /* If set, most threads to replay on (set by -k) */
+    int split = 0;       /* If set, threads share each trace (--split) */
+    int format = FMT_TEXT; /* How to write the results (set by --format) */
+    FILE *results = stdout;/* Where machine-readable results go */
+    meta_t meta;           /* build and host, for those results */
+    static struct option long_opts[] = {
+	{"format", required_argument, NULL, 'F'},
+	{"split", no_argument, NULL, 'S'},
+	{NULL, 0, NULL, 0}
+    };
+    char path[MAXLINE];  /* trace file to stream */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +243,8 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:M:j:k:hvVgalsHP", long_opts,
+			    NULL)) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,12 +270,49 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'j': /* Check traces in parallel, 0 for one per CPU */
+            jobs = atoi(optarg);
+            if (jobs <= 0)
+                jobs = sysconf(_SC_NPROCESSORS_ONLN);
+            break;
+        case 'k': /* Replay on 1..n threads sharing one heap, 0 for one per CPU */
+            threads = atoi(optarg);
+            if (threads <= 0)
+                threads = sysconf(_SC_NPROCESSORS_ONLN);
+            break;
+        case 'S': /* With -k, split each trace among the threads (--split) */
+            split = 1;
+            break;
+        case 's': /* Stream traces instead of loading them */
+            stream = 1;
+            break;
+        case 'H': /* Histogram the latency of each mm request */
+            latency = 1;
+            break;
+        case 'P': /* Count hardware events while replaying each trace */
+            counters = 1;
+            break;
+        case 'M': /* Give huge blocks their own mapping in mm */
+            map_min = strtoul(optarg, NULL, 0);
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
         case 'V': /* Be more verbose than -v */
             verbose = 2;
             break;
+        case 'F': /* Write the results as json or csv (--format) */
+            if (!strcmp(optarg, "json"))
+                format = FMT_JSON;
+            else if (!strcmp(optarg, "csv"))
+                format = FMT_CSV;
+            else if (!strcmp(optarg, "text"))
+                format = FMT_TEXT;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
         case 'h': /* Print this message */
 	    usage();
             exit(0);
@@ -199,6 +322,24 @@ int main(int argc, char **argv)
         }
     }
 	
+    /*
+     * Machine-readable results get stdout to themselves, and everything
+     * else that would have gone there goes to stderr instead
+     */
+    if (format != FMT_TEXT) {
+	fflush(stdout);
+	if ((results = fdopen(dup(STDOUT_FILENO), "w")) == NULL)
+	    unix_error("ERROR: could not duplicate stdout");
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    memset(&meta, 0, sizeof(meta));
+
+    /* mdriver-all runs every package it was built with, and libc too */
+    for (num_allocs = 0; mm_allocs[num_allocs].name != NULL; num_allocs++)
+	;
+    if (num_allocs > 1 && !stream)
+	run_libc = 1;
+
     /* 
      * Check and print team info 
      */
@@ -235,8 +376,50 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
-    /* Initialize the timing package */
+    /* Read each trace once; libc and mm replay the same copy */
+    traces = (trace_t **)calloc(num_tracefiles, sizeof(trace_t *));
+    if (traces == NULL)
+	unix_error("traces calloc in main failed");
+    for (i=0; i < num_tracefiles && !stream; i++)
+	traces[i] = read_trace(tracedir, tracefiles[i]);
+    if (stream && run_libc) {
+	printf("Streaming (-s) runs mm malloc only; ignoring -l\n");
+	run_libc = 0;
+    }
+    if (stream && latency) {
+	printf("Streaming (-s) times whole chunks only; ignoring -H\n");
+	latency = 0;
+    }
+    if (stream && counters) {
+	printf("Streaming (-s) times whole chunks only; ignoring -P\n");
+	counters = 0;
+    }
+    if (stream && threads) {
+	printf("Streaming (-s) replays on one thread only; ignoring -k\n");
+	threads = 0;
+    }
+
+    /* With -j, every timed run goes on the same CPU */
+    if (jobs > 1 && !stream)
+	pin_cpu();
+
+    /* Initialize the timing package and the fill kernel */
     init_fsecs();
+    meta.isa = mk_init();
+    if (verbose)
+	printf("Filling blocks of %zu bytes or more with %s kernels.\n",
+	       mk_threshold(), meta.isa);
+    if (latency) {
+	meta.lat_timer = lat_init();
+	if (verbose)
+	    printf("Timing requests with %s.\n", meta.lat_timer);
+    }
+    else if (threads)
+	lat_init();
+    if (counters && pc_open() == 0) {
+	printf("No performance counters could be opened; ignoring -P\n");
+	counters = 0;
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -252,7 +435,7 @@ int main(int argc, char **argv)
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
+	    trace = traces[i];
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
@@ -263,7 +446,6 @@ int main(int argc, char **argv)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
 	    }
-	    free_trace(trace);
 	}
 
 	/* Display the libc results in a compact table */
@@ -274,87 +456,172 @@ int main(int argc, char **argv)
     }
 
     /*
-     * Always run and evaluate the student's mm package
+     * Always run and evaluate the student's mm package, and in an
+     * mdriver-all build every other package in the registry as well
      */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
+    all_stats = (stats_t **)calloc(num_allocs, sizeof(stats_t *));
+    all_perf = (double (*)[3])calloc(num_allocs, sizeof(*all_perf));
+    all_errors = (int *)calloc(num_allocs, sizeof(int));
+    if (all_stats == NULL || all_perf == NULL || all_errors == NULL)
+	unix_error("all_stats calloc in main failed");
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
+    for (a = 0; a < num_allocs; a++) {
+	mm_cur = &mm_allocs[a];
+	errors = 0;
 	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+	    printf("\nTesting %s malloc\n", mm_cur->name);
 
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
-	printf("\n");
-    }
+	/* Allocate the mm stats array, with one stats_t struct per tracefile */
+	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mm_stats == NULL)
+	    unix_error("mm_stats calloc in main failed");
+	if (mm_cur->mmap_threshold != NULL)
+	    mm_cur->mmap_threshold(map_min);
 
-    /* 
-     * Accumulate the aggregate statistics for the student's mm package 
-     */
-    secs = 0;
-    ops = 0;
-    util = 0;
-    numcorrect = 0;
-    for (i=0; i < num_tracefiles; i++) {
-	secs += mm_stats[i].secs;
-	ops += mm_stats[i].ops;
-	util += mm_stats[i].util;
-	if (mm_stats[i].valid)
-	    numcorrect++;
-    }
-    avg_mm_util = util/num_tracefiles;
+	/* With -j, check and measure the traces in parallel processes first */
+	if (jobs > 1 && !stream)
+	    eval_mm_parallel(traces, num_tracefiles, jobs, mm_stats);
 
-    /* 
-     * Compute and print the performance index 
-     */
-    if (errors == 0) {
-	avg_mm_throughput = ops/secs;
+	/* Evaluate student's mm malloc package using the K-best scheme */
+	for (i=0; i < num_tracefiles; i++) {
+	    if (stream) {
+		strcpy(path, tracedir);
+		strcat(path, tracefiles[i]);
+		eval_mm_stream(path, i, &ranges, &mm_stats[i]);
+		continue;
+	    }
+	    trace = traces[i];
+	    mm_stats[i].ops = trace->num_ops;
+	    if (jobs <= 1) {
+		if (verbose > 1)
+		    printf("Checking mm_malloc for correctness, ");
+		mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+		if (mm_stats[i].valid) {
+		    if (verbose > 1)
+			printf("efficiency, ");
+		    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+		}
+	    }
+	    if (mm_stats[i].valid) {
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		if (verbose > 1)
+		    printf("and performance.\n");
+		mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		if (latency) {
+		    mm_stats[i].lat = (lat_hist_t *)calloc(3, sizeof(lat_hist_t));
+		    if (mm_stats[i].lat == NULL)
+			unix_error("lat calloc in main failed");
+		    eval_mm_latency(trace, mm_stats[i].lat);
+		}
+		if (counters) {
+		    pc_start();
+		    eval_mm_speed(&speed_params);
+		    pc_stop(mm_stats[i].ctr);
+		}
+	    }
+	}
 
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+	/* Display the mm results in a compact table */
+	if (verbose) {
+	    printf("\nResults for %s malloc:\n", mm_cur->name);
+	    printresults(num_tracefiles, mm_stats);
+	    printf("\n");
+	}
+	if (latency) {
+	    printlatency(num_tracefiles, mm_stats);
+	    printf("\n");
 	}
+	if (counters) {
+	    printcounters(num_tracefiles, mm_stats);
+	    printf("\n");
+	}
+
+	/* 
+	 * Accumulate the aggregate statistics for this mm package 
+	 */
+	secs = 0;
+	ops = 0;
+	util = 0;
+	numcorrect = 0;
+	for (i=0; i < num_tracefiles; i++) {
+	    secs += mm_stats[i].secs;
+	    ops += mm_stats[i].ops;
+	    util += mm_stats[i].util;
+	    if (mm_stats[i].valid)
+		numcorrect++;
+	}
+	avg_mm_util = util/num_tracefiles;
+
+	/* 
+	 * Compute and print the performance index 
+	 */
+	if (errors == 0) {
+	    avg_mm_throughput = ops/secs;
+
+	    p1 = UTIL_WEIGHT * avg_mm_util;
+	    if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+		p2 = (double)(1.0 - UTIL_WEIGHT);
+	    } 
+	    else {
+		p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
+		    (avg_mm_throughput/AVG_LIBC_THRUPUT);
+	    }
 	
-	perfindex = (p1 + p2)*100.0;
-	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
-	       p1*100, 
-	       p2*100, 
-	       perfindex);
+	    perfindex = (p1 + p2)*100.0;
+	    if (num_allocs == 1)
+		printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+		       p1*100, 
+		       p2*100, 
+		       perfindex);
+	    all_perf[a][0] = p1*100;
+	    all_perf[a][1] = p2*100;
+	    all_perf[a][2] = perfindex;
 	
+	}
+	else { /* There were errors */
+	    perfindex = 0.0;
+	    if (num_allocs == 1)
+		printf("Terminated with %d errors\n", errors);
+	    all_perf[a][0] = all_perf[a][1] = all_perf[a][2] = -1;
+	}
+	all_stats[a] = mm_stats;
+	all_errors[a] = errors;
     }
-    else { /* There were errors */
-	perfindex = 0.0;
-	printf("Terminated with %d errors\n", errors);
+
+    /* With -k, see how mm.c scales on threads sharing its heap */
+    if (threads)
+	eval_mt(traces, all_stats[0], num_tracefiles, threads, split);
+
+    for (i=0; i < num_tracefiles; i++)
+	if (traces[i] != NULL)
+	    free_trace(traces[i]);
+
+    /* mm.c is the package that is graded */
+    mm_stats = all_stats[0];
+    errors = all_errors[0];
+    perfindex = (errors == 0) ? all_perf[0][2] : 0.0;
+    for (i=0, numcorrect=0; i < num_tracefiles; i++)
+	if (mm_stats[i].valid)
+	    numcorrect++;
+    if (num_allocs > 1)
+	printmatrix(num_tracefiles, tracefiles, libc_stats, all_stats,
+		    all_perf, all_errors, num_allocs);
+
+    /* Write the machine-readable results, if asked for */
+    if (format != FMT_TEXT) {
+	meta.counters = counters;
+	getmeta(&meta);
+	if (format == FMT_JSON)
+	    printjson(results, &meta, tracefiles, num_tracefiles, libc_stats,
+		      all_stats, all_perf, all_errors, num_allocs);
+	else
+	    printcsv(results, &meta, tracefiles, num_tracefiles, libc_stats,
+		     all_stats, all_perf, all_errors, num_allocs);
+	fclose(results);
     }
 
     if (autograder) {
@@ -367,22 +634,134 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range set, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range set to detect any overlapping allocated blocks.
+ *
+ * The set is a treap keyed by lo, so each check, insert and removal
+ * is O(log n) expected in the number of live blocks. The ranges in
+ * the set never overlap, which means a new block can only overlap its
+ * predecessor or its successor. Records come from a free list that
+ * is refilled a chunk at a time and never given back.
  ****************************************************************/
 
+#define RANGE_CHUNK 4096  /* range records malloc'd at a time */
+
+static range_t *range_free = NULL;  /* unused range records */
+
+/*
+ * range_get - Take a range record off the free list
+ */
+static range_t *range_get(void)
+{
+    range_t *p;
+    int i;
+
+    if (range_free == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in range_get");
+	for (i = 0; i < RANGE_CHUNK; i++) {
+	    p[i].left = range_free;
+	    range_free = &p[i];
+	}
+    }
+    p = range_free;
+    range_free = p->left;
+    return p;
+}
+
+/*
+ * range_put - Return a range record to the free list
+ */
+static void range_put(range_t *p)
+{
+    p->left = range_free;
+    range_free = p;
+}
+
+/*
+ * range_prio - Random treap priority (xorshift32)
+ */
+static unsigned range_prio(void)
+{
+    static unsigned x = 2463534242u;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+/*
+ * range_insert - Put node in the subtree at root, return the new root
+ */
+static range_t *range_insert(range_t *root, range_t *node)
+{
+    range_t *c;
+
+    if (root == NULL)
+	return node;
+    if (node->lo < root->lo) {
+	root->left = range_insert(root->left, node);
+	if (root->left->prio < root->prio) {     /* rotate right */
+	    c = root->left;
+	    root->left = c->right;
+	    c->right = root;
+	    root = c;
+	}
+    }
+    else {
+	root->right = range_insert(root->right, node);
+	if (root->right->prio < root->prio) {    /* rotate left */
+	    c = root->right;
+	    root->right = c->left;
+	    c->left = root;
+	    root = c;
+	}
+    }
+    return root;
+}
+
+/*
+ * range_join - Merge two subtrees, every key in a below every key in b
+ */
+static range_t *range_join(range_t *a, range_t *b)
+{
+    if (a == NULL)
+	return b;
+    if (b == NULL)
+	return a;
+    if (a->prio < b->prio) {
+	a->right = range_join(a->right, b);
+	return a;
+    }
+    b->left = range_join(a, b->left);
+    return b;
+}
+
+/*
+ * range_free_tree - Return every record of a subtree to the free list
+ */
+static void range_free_tree(range_t *root)
+{
+    if (root == NULL)
+	return;
+    range_free_tree(root->left);
+    range_free_tree(root->right);
+    range_put(root);
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
  *     we create a range struct for this block and add it to the range list. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+static int add_range(range_t **ranges, char *lo, size_t size, 
+		     int tracenum, long opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred = NULL, *succ = NULL;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -395,36 +774,50 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap (or a mapping) */
+    if (!mem_contains(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. Find the
+     * nearest range starting at or below lo and the nearest above it.
+     */
+    for (p = *ranges;  p != NULL; ) {
+	if (p->lo <= lo) {
+	    pred = p;
+	    p = p->right;
+	}
+	else {
+	    succ = p;
+	    p = p->left;
+	}
+    }
+    p = NULL;
+    if (pred != NULL && pred->hi >= lo)
+	p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+	p = succ;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range record and adding it to the range set.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = range_get();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    p->prio = range_prio();
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -433,18 +826,14 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **pp = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *pp) != NULL && p->lo != lo)
+	pp = (lo < p->lo) ? &p->left : &p->right;
+    if (p != NULL) {
+	*pp = range_join(p->left, p->right);
+	range_put(p);
     }
 }
 
@@ -453,13 +842,7 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    range_free_tree(*ranges);
     *ranges = NULL;
 }
 
@@ -469,41 +852,45 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A binary
+ *     trace (see tracefmt.h) is mapped; anything else is parsed as
+ *     .rep text.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
+    trace_hdr_t hdr;
     char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    struct stat st;
+    FILE *tracefile;
+    int fd;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
 
     /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
 	
-    /* Read the trace file header */
+    /* Open the trace file and look for a binary header */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+    if (st.st_size >= (off_t)sizeof(hdr) &&
+	pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+	memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+	read_bin_trace(trace, fd, path, st.st_size);
+	close(fd);
+    }
+    else {
+	if ((tracefile = fdopen(fd, "r")) == NULL)
+	    unix_error("fdopen failed in read_trace");
+	read_rep_trace(trace, tracefile, path);
+	fclose(tracefile);
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
@@ -515,6 +902,29 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
+    return trace;
+}
+
+/*
+ * read_rep_trace - Parse the header and requests of a .rep text trace
+ */
+static void read_rep_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    char type[MAXLINE];
+    unsigned index, size;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+    fscanf(tracefile, "%d", &(trace->num_ids));     
+    fscanf(tracefile, "%d", &(trace->num_ops));     
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -538,6 +948,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -547,20 +958,97 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	op_index++;
 	
     }
-    fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
-    
-    return trace;
+}
+
+/*
+ * read_bin_trace - Set up a binary trace. Plain records are mapped and
+ *     used in place; varint coded ones are decoded into an array. Every
+ *     request is checked once here so the replay loops need not.
+ */
+static void read_bin_trace(trace_t *trace, int fd, char *path, size_t len)
+{
+    const unsigned char *p, *end;
+    trace_hdr_t *hdr;
+    traceop_t *op;
+    uint64_t index, size;
+    unsigned type;
+    int i;
+
+    if ((trace->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+			   fd, 0)) == MAP_FAILED)
+	unix_error("mmap failed in read_trace");
+    trace->map_len = len;
+    hdr = (trace_hdr_t *)trace->map;
+    if (hdr->data_bytes > len - sizeof(trace_hdr_t)) {
+	printf("Truncated binary tracefile %s\n", path);
+	exit(1);
+    }
+    if (hdr->num_ids > INT_MAX || hdr->num_ops > INT_MAX) {
+	printf("Tracefile %s is too big to load; replay it with -s\n", path);
+	exit(1);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    p = (const unsigned char *)(hdr + 1);
+    end = p + hdr->data_bytes;
+
+    if (hdr->flags & TRACE_VARINT) {
+	if ((trace->ops = 
+	     (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in read_trace");
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    size = 0;
+	    if (p >= end || (type = *p++) > TRACE_REALLOC ||
+		!trace_get_varint(&p, end, &index) ||
+		(type != TRACE_FREE && !trace_get_varint(&p, end, &size))) {
+		printf("Bad request %d in binary tracefile %s\n", i, path);
+		exit(1);
+	    }
+	    if (index > INT_MAX || size > INT_MAX) {
+		printf("Request %d in tracefile %s is too big to load; "
+		       "replay it with -s\n", i, path);
+		exit(1);
+	    }
+	    op->type = type;
+	    op->index = index;
+	    op->size = size;
+	}
+    }
+    else {
+	if (hdr->data_bytes < (uint64_t)trace->num_ops * sizeof(traceop_t)) {
+	    printf("Truncated binary tracefile %s\n", path);
+	    exit(1);
+	}
+	trace->ops = (traceop_t *)p;
+    }
+
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if ((unsigned)op->type > TRACE_REALLOC || op->index < 0 ||
+	    op->index >= trace->num_ids || op->size < 0) {
+	    printf("Bad request %d in binary tracefile %s\n", i, path);
+	    exit(1);
+	}
+    }
 }
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(), or
+ *              unmap the file the requests were used from.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map == NULL || (void *)trace->ops != 
+	(void *)((trace_hdr_t *)trace->map + 1))
+	free(trace->ops);     /* free the three arrays... */
+    if (trace->map != NULL)
+	munmap(trace->map, trace->map_len);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -589,7 +1077,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (mm_cur->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -604,7 +1092,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = mm_cur->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -622,7 +1110,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * if we realloc the block and wish to make sure that the old
 	     * data was copied to the new block
 	     */
-	    memset(p, index & 0xFF, size);
+	    mk_fill(p, index & 0xFF, size);
 
 	    /* Remember region */
 	    trace->blocks[index] = p;
@@ -633,7 +1121,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = mm_cur->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -659,7 +1147,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	      }
 	    }
-	    memset(newp, index & 0xFF, size);
+	    mk_fill(newp, index & 0xFF, size);
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
@@ -671,7 +1159,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    mm_cur->free(p);
 	    break;
 
 	default:
@@ -690,9 +1178,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
  *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   package on the trace, summed over all heap segments. The trace 
+ *   never has the package give memory back, so this is the high water 
+ *   mark of the heap. Blocks mapped outside
+ *   the heap (-M) add the high water mark of mapped bytes.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -707,7 +1196,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm_cur->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -717,7 +1206,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = mm_cur->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1228,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = mm_cur->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -760,7 +1249,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    mm_cur->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -774,7 +1263,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)(mem_heapsize() + mem_mapsize()));
 }
 
 
@@ -790,7 +1279,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (mm_cur->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -800,7 +1289,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm_cur->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -809,7 +1298,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = mm_cur->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -817,7 +1306,7 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            mm_cur->free(block);
             break;
 
 	default:
@@ -825,6 +1314,319 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_latency - Replay a trace timing each request on its own, and
+ *    bin the latencies by request type. Short traces are replayed
+ *    until LAT_SAMPLES requests have been timed. This runs after the
+ *    K-best timing, so the timestamps do not slow the throughput runs.
+ */
+static void eval_mm_latency(trace_t *trace, lat_hist_t *lat)
+{
+    int i, index, type;
+    long timed;
+    char *p;
+    uint64_t t0, t1;
+
+    for (timed = 0; timed < LAT_SAMPLES; timed += trace->num_ops) {
+	mem_reset_brk();
+	if (mm_cur->init() < 0) 
+	    app_error("mm_init failed in eval_mm_latency");
+
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    type = trace->ops[i].type;
+	    index = trace->ops[i].index;
+	    switch (type) {
+
+	    case ALLOC: /* mm_malloc */
+		t0 = lat_now();
+		p = mm_cur->malloc(trace->ops[i].size);
+		t1 = lat_now();
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		p = trace->blocks[index];
+		t0 = lat_now();
+		p = mm_cur->realloc(p, trace->ops[i].size);
+		t1 = lat_now();
+		if (p == NULL)
+		    app_error("mm_realloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+		break;
+
+	    case FREE: /* mm_free */
+		p = trace->blocks[index];
+		t0 = lat_now();
+		mm_cur->free(p);
+		t1 = lat_now();
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_latency");
+	    }
+	    lat_add(&lat[type], t0, t1);
+	}
+	if (trace->num_ops == 0)
+	    break;
+    }
+}
+
+/*
+ * stream_slots - Grow the block arrays of a streamed trace to n slots
+ */
+static void stream_slots(char ***blocks, size_t **sizes, size_t *max, 
+			 size_t n)
+{
+    if (n <= *max)
+	return;
+    *max = (n > 2 * *max) ? n : 2 * *max;
+    if ((*blocks = (char **)realloc(*blocks, *max * sizeof(char *))) == NULL ||
+	(*sizes = (size_t *)realloc(*sizes, *max * sizeof(size_t))) == NULL)
+	unix_error("realloc failed in eval_mm_stream");
+}
+
+/*
+ * eval_mm_stream - Evaluate the mm package on a trace read from disk a
+ *    chunk at a time (-s), for traces too big to load. The first pass
+ *    checks correctness as eval_mm_valid does and keeps the high water
+ *    mark for the utilization. The second pass is timed, one chunk at
+ *    a time, so the reading and parsing done while waiting for a chunk
+ *    is left out. Each pass streams the file again, so the trace is
+ *    replayed once rather than K-best.
+ */
+static void eval_mm_stream(char *path, int tracenum, range_t **ranges,
+			   stats_t *stats)
+{
+    tstream_t *ts;
+    ts_chunk_t *ch;
+    ts_op_t *op;
+    char **blocks = NULL;
+    size_t *sizes = NULL;
+    size_t max_slots = 0, i, j, oldsize, total_size = 0, max_total_size = 0;
+    long opnum;
+    char *p;
+    struct timespec t0, t1;
+    volatile size_t touch;
+
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", path);
+    stats->valid = 0;
+    stats->ops = 0;
+
+    /* Pass 1: correctness and utilization */
+    ts = ts_open(path);
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_cur->init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	ts_close(ts);
+	return;
+    }
+    while ((ch = ts_next(ts)) != NULL) {
+	stream_slots(&blocks, &sizes, &max_slots, ch->num_slots);
+	for (i = 0; i < ch->num_ops; i++) {
+	    op = &ch->ops[i];
+	    opnum = ch->first + i;
+	    switch (op->type) {
+
+	    case ALLOC:
+		if ((p = mm_cur->malloc(op->size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_malloc failed.");
+		    goto out;
+		}
+		if (add_range(ranges, p, op->size, tracenum, opnum) == 0)
+		    goto out;
+		mk_fill(p, op->slot & 0xFF, op->size);
+		blocks[op->slot] = p;
+		sizes[op->slot] = op->size;
+		total_size += op->size;
+		break;
+
+	    case REALLOC:
+		if ((p = mm_cur->realloc(blocks[op->slot], op->size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_realloc failed.");
+		    goto out;
+		}
+		remove_range(ranges, blocks[op->slot]);
+		if (add_range(ranges, p, op->size, tracenum, opnum) == 0)
+		    goto out;
+		oldsize = (op->size < sizes[op->slot]) ? op->size : sizes[op->slot];
+		for (j = 0; j < oldsize; j++)
+		    if (p[j] != (char)(op->slot & 0xFF))
+			break;
+		if (j < oldsize) {
+		    malloc_error(tracenum, opnum, "mm_realloc did not preserve "
+				 "the data from old block");
+		    goto out;
+		}
+		mk_fill(p, op->slot & 0xFF, op->size);
+		total_size += op->size - sizes[op->slot];
+		blocks[op->slot] = p;
+		sizes[op->slot] = op->size;
+		break;
+
+	    case FREE:
+		remove_range(ranges, blocks[op->slot]);
+		mm_cur->free(blocks[op->slot]);
+		total_size -= sizes[op->slot];
+		break;
+	    }
+	    if (total_size > max_total_size)
+		max_total_size = total_size;
+	}
+	stats->ops += ch->num_ops;
+    }
+    ts_close(ts);
+    stats->util = (double)max_total_size / 
+	(double)(mem_heapsize() + mem_mapsize());
+
+    /* Pass 2: throughput, timing only the replay of each chunk */
+    ts = ts_open(path);
+    mem_reset_brk();
+    if (mm_cur->init() < 0) 
+	app_error("mm_init failed in eval_mm_stream");
+    stats->secs = 0;
+    while ((ch = ts_next(ts)) != NULL) {
+	stream_slots(&blocks, &sizes, &max_slots, ch->num_slots);
+	for (i = 0, touch = 0; i < ch->num_ops; i++)  /* pull it into cache */
+	    touch += ch->ops[i].size;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < ch->num_ops; i++) {
+	    op = &ch->ops[i];
+	    switch (op->type) {
+	    case ALLOC:
+		if ((blocks[op->slot] = mm_cur->malloc(op->size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_stream");
+		break;
+	    case REALLOC:
+		p = mm_cur->realloc(blocks[op->slot], op->size);
+		if ((blocks[op->slot] = p) == NULL)
+		    app_error("mm_realloc error in eval_mm_stream");
+		break;
+	    case FREE:
+		mm_cur->free(blocks[op->slot]);
+		break;
+	    }
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	stats->secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+    stats->valid = 1;
+
+ out:
+    ts_close(ts);
+    free(blocks);
+    free(sizes);
+}
+
+/*
+ * pin_cpu - Keep this process on one CPU, the highest it may use, so
+ *    timed runs all see the same core and caches. CPU 0 is passed over
+ *    where possible since it tends to take the most interrupts.
+ */
+static void pin_cpu(void)
+{
+    cpu_set_t one;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(run_cpus), &run_cpus) < 0)
+	return;
+    for (cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--)
+	if (CPU_ISSET(cpu, &run_cpus))
+	    break;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    if (sched_setaffinity(0, sizeof(one), &one) == 0 && verbose)
+	printf("Timing on CPU %d\n", cpu);
+}
+
+/*
+ * eval_mm_parallel - Check correctness and space utilization of the mm
+ *    package (-j), running up to jobs traces at once, each in a child
+ *    process with its own copy of the heap. A child reports through a
+ *    pipe; one that dies marks its trace invalid instead of taking the
+ *    driver down. Timing is left to the caller, one trace at a time.
+ */
+typedef struct {
+    int valid;       /* result of eval_mm_valid */
+    int errors;      /* errors the child counted */
+    double util;     /* result of eval_mm_util, if valid */
+} check_t;
+
+static void eval_mm_parallel(trace_t **traces, int num_traces, int jobs,
+			     stats_t *stats)
+{
+    pid_t *pids;
+    int *fds;
+    int fd[2], status, next = 0, running = 0, i;
+    range_t *ranges = NULL;
+    check_t r;
+    pid_t pid;
+
+    if ((pids = (pid_t *)calloc(num_traces, sizeof(pid_t))) == NULL ||
+	(fds = (int *)calloc(num_traces, sizeof(int))) == NULL)
+	unix_error("calloc failed in eval_mm_parallel");
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness and efficiency, "
+	       "%d traces at a time\n", jobs);
+
+    while (next < num_traces || running > 0) {
+	/* Start children until jobs of them are running */
+	while (next < num_traces && running < jobs) {
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in eval_mm_parallel");
+	    fflush(stdout);  /* or the child prints it again */
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+	    if (pid == 0) {
+		close(fd[0]);
+		sched_setaffinity(0, sizeof(run_cpus), &run_cpus);
+		r.valid = eval_mm_valid(traces[next], next, &ranges);
+		r.util = r.valid ? eval_mm_util(traces[next], next, &ranges) : 0;
+		r.errors = errors;
+		if (write(fd[1], &r, sizeof(r)) != sizeof(r))
+		    unix_error("write failed in eval_mm_parallel");
+		exit(0);
+	    }
+	    close(fd[1]);
+	    pids[next] = pid;
+	    fds[next] = fd[0];
+	    next++;
+	    running++;
+	}
+
+	/* Collect whichever child finishes first */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in eval_mm_parallel");
+	for (i = 0; i < num_traces && pids[i] != pid; i++)
+	    ;
+	if (i == num_traces)
+	    continue;
+	running--;
+	if (read(fds[i], &r, sizeof(r)) == sizeof(r)) {
+	    stats[i].valid = r.valid;
+	    stats[i].util = r.util;
+	    errors += r.errors;
+	}
+	else {
+	    stats[i].valid = 0;
+	    errors++;
+	    if (WIFSIGNALED(status))
+		printf("ERROR [trace %d]: check died with signal %d\n", 
+		       i, WTERMSIG(status));
+	    else
+		printf("ERROR [trace %d]: check exited with status %d\n", 
+		       i, WEXITSTATUS(status));
+	}
+	close(fds[i]);
+    }
+    free(pids);
+    free(fds);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -910,6 +1712,267 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*****************************************
+ * Multithreaded replay of the traces (-k)
+ *****************************************/
+
+#define MT_REPS 3  /* each replay is timed this many times, best kept */
+
+/* A malloc package as the replaying threads call it */
+typedef struct {
+    const char *name;
+    int mode;                     /* mm_cache_mode to run in; -1 for libc */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} mt_alloc_t;
+
+static pthread_mutex_t mt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * lock_malloc, lock_free, lock_realloc - mm_* under one lock, for when
+ *    the front end is off and mm.c is not thread safe
+ */
+static void *lock_malloc(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&mt_lock);
+    return p;
+}
+
+static void lock_free(void *ptr)
+{
+    pthread_mutex_lock(&mt_lock);
+    mm_free(ptr);
+    pthread_mutex_unlock(&mt_lock);
+}
+
+static void *lock_realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_lock);
+    p = mm_realloc(ptr, size);
+    pthread_mutex_unlock(&mt_lock);
+    return p;
+}
+
+/* The packages replayed, in the order they are run */
+static mt_alloc_t mt_allocs[] = {
+    {"mm lock", MM_CACHE_OFF, lock_malloc, lock_free, lock_realloc},
+    {"mm thread", MM_CACHE_THREAD, mm_malloc, mm_free, mm_realloc},
+    {"mm cpu", MM_CACHE_CPU, mm_malloc, mm_free, mm_realloc},
+    {"libc", -1, malloc, free, realloc},
+};
+#define MT_ALLOCS (int)(sizeof(mt_allocs) / sizeof(mt_allocs[0]))
+
+/* One replaying thread */
+typedef struct {
+    pthread_t tid;
+    mt_alloc_t *alloc;
+    trace_t *trace;
+    int id, nthreads;      /* this is thread id of nthreads */
+    int split;             /* if set, replay only ids that are id mod nthreads */
+    pthread_barrier_t *start; /* all threads start together */
+    lat_hist_t *lat;       /* if not NULL, time each request into lat[type] */
+    char **blocks;         /* this thread's copy of trace->blocks */
+    struct timespec begin, end; /* when this thread's replay ran */
+} mt_thread_t;
+
+/*
+ * mt_replay - Replay the thread's copy or share of the trace, then free
+ *    whatever the trace left allocated, untimed
+ */
+static void *mt_replay(void *arg)
+{
+    mt_thread_t *t = (mt_thread_t *)arg;
+    mt_alloc_t *m = t->alloc;
+    trace_t *trace = t->trace;
+    traceop_t *op;
+    char *p;
+    uint64_t t0 = 0, t1;
+    int i;
+
+    pthread_barrier_wait(t->start);
+    clock_gettime(CLOCK_MONOTONIC, &t->begin);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	op = &trace->ops[i];
+	if (t->split && op->index % t->nthreads != t->id)
+	    continue;
+	if (t->lat != NULL)
+	    t0 = lat_now();
+	switch (op->type) {
+
+	case ALLOC: /* malloc */
+	    if ((p = m->malloc(op->size)) == NULL)
+		app_error("malloc failed in mt_replay");
+	    break;
+
+	case REALLOC: /* realloc */
+	    if ((p = m->realloc(t->blocks[op->index], op->size)) == NULL)
+		app_error("realloc failed in mt_replay");
+	    break;
+
+	case FREE: /* free */
+	    m->free(t->blocks[op->index]);
+	    p = NULL;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in mt_replay");
+	}
+	if (t->lat != NULL) {
+	    t1 = lat_now();
+	    lat_add(&t->lat[op->type], t0, t1);
+	}
+	t->blocks[op->index] = p;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t->end);
+
+    for (i = 0;  i < trace->num_ids;  i++)
+	if (t->blocks[i] != NULL)
+	    m->free(t->blocks[i]);
+    return NULL;
+}
+
+/*
+ * mt_run - Replay a trace on nthreads threads at once, each with its
+ *    own block slots, on one freshly initialized heap. Returns the
+ *    seconds from the first thread starting to the last one finishing.
+ *    With lat, thread i times its requests into lat[3*i..3*i+2].
+ */
+static double mt_run(mt_alloc_t *m, trace_t *trace, int nthreads, int split,
+		     lat_hist_t *lat)
+{
+    mt_thread_t *t;
+    pthread_barrier_t start;
+    struct timespec begin, end;
+    int i;
+
+    if (m->mode >= 0) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in mt_run");
+	mm_cache_mode(m->mode);
+    }
+    if ((t = (mt_thread_t *)calloc(nthreads, sizeof(mt_thread_t))) == NULL)
+	unix_error("calloc failed in mt_run");
+    pthread_barrier_init(&start, NULL, nthreads);
+    for (i = 0; i < nthreads; i++) {
+	t[i].alloc = m;
+	t[i].trace = trace;
+	t[i].id = i;
+	t[i].nthreads = nthreads;
+	t[i].split = split;
+	t[i].start = &start;
+	t[i].lat = (lat != NULL) ? &lat[3*i] : NULL;
+	if ((t[i].blocks = (char **)calloc(trace->num_ids + 1, 
+					   sizeof(char *))) == NULL)
+	    unix_error("calloc failed in mt_run");
+	if ((errno = pthread_create(&t[i].tid, NULL, mt_replay, &t[i])) != 0)
+	    unix_error("pthread_create failed in mt_run");
+    }
+
+    begin = end = (struct timespec){0, 0};
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(t[i].tid, NULL);
+	if (i == 0 || t[i].begin.tv_sec < begin.tv_sec ||
+	    (t[i].begin.tv_sec == begin.tv_sec && 
+	     t[i].begin.tv_nsec < begin.tv_nsec))
+	    begin = t[i].begin;
+	if (t[i].end.tv_sec > end.tv_sec ||
+	    (t[i].end.tv_sec == end.tv_sec && t[i].end.tv_nsec > end.tv_nsec))
+	    end = t[i].end;
+	free(t[i].blocks);
+    }
+    if (m->mode >= 0)
+	mm_cache_mode(MM_CACHE_OFF);
+    pthread_barrier_destroy(&start);
+    free(t);
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+/*
+ * eval_mt - Replay the valid traces on 1 to maxthreads threads sharing
+ *    one heap (-k), with mm.c in each front end mode and with libc. Each
+ *    thread replays its own copy of every trace, or with --split the
+ *    blocks of the trace whose id is its number mod the thread count.
+ *    Prints the throughput over all the traces, its speedup over one
+ *    thread, the scaling efficiency (speedup / threads), and the median
+ *    and 99th percentile request latency over all of the threads, and
+ *    of the slowest thread. -V lists the latencies of every thread.
+ */
+static void eval_mt(trace_t **traces, stats_t *stats, int n, int maxthreads,
+		    int split)
+{
+    lat_hist_t *lat, *thread_lat, all;
+    double secs, best, s, ops, kops, base = 0, p99, worst;
+    int m, k, i, r, type;
+
+    /* Undo -j's pinning, so the threads can spread out */
+    if (CPU_COUNT(&run_cpus) > 0)
+	sched_setaffinity(0, sizeof(run_cpus), &run_cpus);
+
+    if ((lat = (lat_hist_t *)malloc(3 * maxthreads * sizeof(lat_hist_t))) == NULL ||
+	(thread_lat = (lat_hist_t *)malloc(maxthreads * sizeof(lat_hist_t))) == NULL)
+	unix_error("malloc failed in eval_mt");
+
+    printf("\nMultithreaded replay (%s, best of %d):\n",
+	   split ? "traces split among the threads by block id" : 
+	   "a copy of every trace per thread", MT_REPS);
+    printf("%-10s%8s%10s%9s%7s%9s%9s%11s\n", "alloc", "threads", "Kops",
+	   "speedup", "effic", "p50(ns)", "p99(ns)", "worst p99");
+    for (m = 0; m < MT_ALLOCS; m++) {
+	for (k = 1; k <= maxthreads; k++) {
+	    secs = ops = 0;
+	    memset(lat, 0, 3 * k * sizeof(lat_hist_t));
+	    for (i = 0; i < n; i++) {
+		if (!stats[i].valid)
+		    continue;
+		for (r = 0, best = 0; r < MT_REPS; r++) {
+		    s = mt_run(&mt_allocs[m], traces[i], k, split, NULL);
+		    if (r == 0 || s < best)
+			best = s;
+		}
+		secs += best;
+		ops += split ? traces[i]->num_ops : 
+		    (double)k * traces[i]->num_ops;
+
+		/* Then once more for the latencies, as with -H */
+		mt_run(&mt_allocs[m], traces[i], k, split, lat);
+	    }
+
+	    memset(&all, 0, sizeof(all));
+	    memset(thread_lat, 0, k * sizeof(lat_hist_t));
+	    for (i = 0, worst = 0; i < k; i++) {
+		for (type = ALLOC; type <= REALLOC; type++)
+		    lat_merge(&thread_lat[i], &lat[3*i + type]);
+		lat_merge(&all, &thread_lat[i]);
+		if ((p99 = lat_quantile(&thread_lat[i], 0.99)) > worst)
+		    worst = p99;
+	    }
+
+	    kops = (secs > 0) ? ops / 1e3 / secs : 0;
+	    if (k == 1)
+		base = kops;
+	    printf("%-10s%8d%10.0f%8.2fx%6.0f%%%9.0f%9.0f%11.0f\n",
+		   mt_allocs[m].name, k, kops, kops / base, 
+		   kops / base / k * 100.0, lat_quantile(&all, 0.5), 
+		   lat_quantile(&all, 0.99), worst);
+	    if (verbose > 1)
+		for (i = 0; i < k; i++)
+		    printf("%10s%8d%26s%9.0f%9.0f\n", "thread", i, "",
+			   lat_quantile(&thread_lat[i], 0.5),
+			   lat_quantile(&thread_lat[i], 0.99));
+	}
+    }
+    free(lat);
+    free(thread_lat);
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -972,6 +2035,504 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printlatency - prints latency percentiles in nanoseconds for each
+ *    request type of each trace (-H), and over all of the traces
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *names[] = {"malloc", "free", "realloc"};
+    lat_hist_t *all;
+    lat_hist_t *h;
+    int i, type;
+
+    if ((all = (lat_hist_t *)calloc(3, sizeof(lat_hist_t))) == NULL)
+	unix_error("calloc failed in printlatency");
+    printf("Request latency in ns (timer overhead of %llu ticks subtracted):\n",
+	   (unsigned long long)lat_ovhd);
+    printf("%5s %-8s%10s%8s%8s%8s%10s\n",
+	   "trace", "request", "count", "p50", "p99", "p99.9", "max");
+    for (i = 0; i <= n; i++) {
+	if (i < n && stats[i].lat == NULL)
+	    continue;
+	for (type = ALLOC; type <= REALLOC; type++) {
+	    if (i < n) {
+		h = &stats[i].lat[type];
+		lat_merge(&all[type], h);
+	    }
+	    else
+		h = &all[type];
+	    if (h->total == 0)
+		continue;
+	    if (i < n)
+		printf("%5d ", i);
+	    else
+		printf("%5s ", "all");
+	    printf("%-8s%10llu%8.0f%8.0f%8.0f%10.0f\n",
+		   names[type], (unsigned long long)h->total,
+		   lat_quantile(h, 0.5), lat_quantile(h, 0.99),
+		   lat_quantile(h, 0.999), lat_quantile(h, 1.0));
+	}
+    }
+    free(all);
+}
+
+/*
+ * printcounters - prints the hardware events per request in one replay
+ *    of each trace (-P), and over all of the traces. Events the CPU or
+ *    kernel would not count are shown as "-".
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    double sum[PC_NUM], ops = 0, *ctr;
+    int i, k;
+
+    for (k = 0; k < PC_NUM; k++)
+	sum[k] = 0;
+    printf("Events per request (user mode, one replay of each trace):\n");
+    printf("%5s", "trace");
+    for (k = 0; k < PC_NUM; k++)
+	printf("%10s", pc_names[k]);
+    printf("%6s\n", "IPC");
+    for (i = 0; i <= n; i++) {
+	if (i < n) {
+	    if (!stats[i].valid)
+		continue;
+	    ctr = stats[i].ctr;
+	    for (k = 0; k < PC_NUM; k++)
+		sum[k] = (sum[k] < 0 || ctr[k] < 0) ? -1 : sum[k] + ctr[k];
+	    ops += stats[i].ops;
+	    printf("%5d", i);
+	}
+	else {
+	    ctr = sum;
+	    printf("%5s", "all");
+	}
+	for (k = 0; k < PC_NUM; k++) {
+	    if (ctr[k] < 0)
+		printf("%10s", "-");
+	    else
+		printf("%10.2f", ctr[k] / ((i < n) ? stats[i].ops : ops));
+	}
+	if (ctr[PC_CYCLES] > 0 && ctr[PC_INSTRS] >= 0)
+	    printf("%6.2f\n", ctr[PC_INSTRS] / ctr[PC_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
+/*
+ * printmatrix - prints the utilization and throughput of every package
+ *    mdriver-all ran, a column each, side by side with libc, and then
+ *    the total and the perf index of each
+ */
+static void printmatrix(int n, char **tracefiles, stats_t *libc_stats,
+			stats_t **all_stats, double (*all_perf)[3],
+			int *all_errors, int num_allocs)
+{
+    stats_t *s;
+    double secs, ops, util;
+    int i, a;
+
+    printf("\nResults for all malloc packages (util%% and Kops):\n");
+    printf("%-21s", "trace");
+    for (a = 0; a < num_allocs; a++)
+	printf("%15s", mm_allocs[a].name);
+    if (libc_stats != NULL)
+	printf("%8s", "libc");
+    printf("\n");
+
+    for (i = 0; i < n; i++) {
+	printf("%2d %-18.18s", i, tracefiles[i]);
+	for (a = 0; a < num_allocs; a++) {
+	    s = &all_stats[a][i];
+	    if (s->valid)
+		printf("%7.0f%%%7.0f", s->util*100.0, (s->ops/1e3)/s->secs);
+	    else
+		printf("%15s", "-");
+	}
+	if (libc_stats != NULL) {
+	    s = &libc_stats[i];
+	    if (s->valid)
+		printf("%8.0f", (s->ops/1e3)/s->secs);
+	    else
+		printf("%8s", "-");
+	}
+	printf("\n");
+    }
+
+    printf("%-21s", "Total");
+    for (a = 0; a < num_allocs; a++) {
+	if (all_errors[a]) {
+	    printf("%15s", "-");
+	    continue;
+	}
+	for (i = 0, secs = ops = util = 0; i < n; i++) {
+	    secs += all_stats[a][i].secs;
+	    ops += all_stats[a][i].ops;
+	    util += all_stats[a][i].util;
+	}
+	printf("%7.0f%%%7.0f", (util/n)*100.0, (ops/1e3)/secs);
+    }
+    if (libc_stats != NULL) {
+	for (i = 0, secs = ops = 0; i < n; i++) {
+	    secs += libc_stats[i].secs;
+	    ops += libc_stats[i].ops;
+	}
+	printf("%8.0f", (ops/1e3)/secs);
+    }
+    printf("\n");
+
+    printf("%-21s", "Perf index");
+    for (a = 0; a < num_allocs; a++) {
+	if (all_errors[a])
+	    printf("%15s", "errors");
+	else
+	    printf("%11.0f/100", all_perf[a][2]);
+    }
+    printf("\n");
+}
+
+/*
+ * getmeta - Fill in the rest of the build and host description
+ */
+static void getmeta(meta_t *meta)
+{
+    time_t now = time(NULL);
+    char line[MAXLINE], *p;
+    FILE *fp;
+
+    strftime(meta->date, sizeof(meta->date), "%Y-%m-%dT%H:%M:%SZ",
+	     gmtime(&now));
+    if (uname(&meta->host) < 0)
+	memset(&meta->host, 0, sizeof(meta->host));
+    meta->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((fp = fopen("/proc/cpuinfo", "r")) != NULL) {
+	while (fgets(line, MAXLINE, fp) != NULL) {
+	    if (strncmp(line, "model name", 10) != 0 ||
+		(p = strchr(line, ':')) == NULL)
+		continue;
+	    p += 1 + strspn(p + 1, " \t");
+	    p[strcspn(p, "\n")] = '\0';
+	    strcpy(meta->cpu, p);
+	    break;
+	}
+	fclose(fp);
+    }
+#if USE_FCYC
+    meta->timer = "fcyc";
+#elif USE_ITIMER
+    meta->timer = "itimer";
+#else
+    meta->timer = "gettimeofday";
+#endif
+}
+
+/* json_str - Print s as a JSON string */
+static void json_str(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(fp, "\\%c", *s);
+	else if ((unsigned char)*s < 0x20)
+	    fprintf(fp, "\\u%04x", *s);
+	else
+	    putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/* json_num - Print v, or null if it is negative (not measured) */
+static void json_num(FILE *fp, double v)
+{
+    if (v < 0)
+	fprintf(fp, "null");
+    else
+	fprintf(fp, "%.9g", v);
+}
+
+/*
+ * json_traces - Print the per-trace results of one malloc package as a
+ *    JSON array
+ */
+static void json_traces(FILE *fp, meta_t *meta, char **tracefiles, int n,
+			stats_t *stats, int is_mm)
+{
+    static const char *names[] = {"malloc", "free", "realloc"};
+    lat_hist_t *h;
+    int i, k, first;
+
+    fprintf(fp, "[");
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%s\n    {\"trace\": %d, \"file\": ", i ? "," : "", i);
+	json_str(fp, tracefiles[i]);
+	fprintf(fp, ", \"valid\": %s, \"ops\": %.0f",
+		stats[i].valid ? "true" : "false", stats[i].ops);
+	fprintf(fp, ", \"secs\": ");
+	json_num(fp, stats[i].valid ? stats[i].secs : -1);
+	fprintf(fp, ", \"kops\": ");
+	json_num(fp, stats[i].valid && stats[i].secs > 0 ?
+		 stats[i].ops / 1e3 / stats[i].secs : -1);
+	fprintf(fp, ", \"util\": ");
+	json_num(fp, stats[i].valid && is_mm ? stats[i].util : -1);
+	if (stats[i].lat != NULL) {
+	    fprintf(fp, ",\n     \"latency_ns\": {");
+	    for (k = ALLOC, first = 1; k <= REALLOC; k++) {
+		h = &stats[i].lat[k];
+		if (h->total == 0)
+		    continue;
+		fprintf(fp, "%s\"%s\": {\"count\": %llu, \"p50\": %.0f, "
+			"\"p99\": %.0f, \"p99.9\": %.0f, \"max\": %.0f}",
+			first ? "" : ", ", names[k],
+			(unsigned long long)h->total,
+			lat_quantile(h, 0.5), lat_quantile(h, 0.99),
+			lat_quantile(h, 0.999), lat_quantile(h, 1.0));
+		first = 0;
+	    }
+	    fprintf(fp, "}");
+	}
+	if (is_mm && meta->counters && stats[i].valid) {
+	    fprintf(fp, ",\n     \"counters\": {");
+	    for (k = 0; k < PC_NUM; k++) {
+		fprintf(fp, "%s\"%s\": ", k ? ", " : "", pc_names[k]);
+		json_num(fp, stats[i].ctr[k]);
+	    }
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]");
+}
+
+/*
+ * json_total - Print the "total", "errors" and "perf_index" members
+ *    for one mm package, each line starting with indent
+ */
+static void json_total(FILE *fp, const char *indent, int n, stats_t *stats,
+		       int errs, double perf[3])
+{
+    double secs = 0, ops = 0, util = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+	if (stats[i].valid) {
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	}
+    fprintf(fp, ",\n%s\"total\": {\"ops\": %.0f, \"secs\": ", indent, ops);
+    json_num(fp, errs ? -1 : secs);
+    fprintf(fp, ", \"kops\": ");
+    json_num(fp, errs || secs <= 0 ? -1 : ops / 1e3 / secs);
+    fprintf(fp, ", \"util\": ");
+    json_num(fp, errs ? -1 : util / n);
+    fprintf(fp, "},\n%s\"errors\": %d,\n%s\"perf_index\": ", indent, errs,
+	    indent);
+    if (errs)
+	fprintf(fp, "null");
+    else
+	fprintf(fp, "{\"util\": %.2f, \"thru\": %.2f, \"total\": %.2f}",
+		perf[0], perf[1], perf[2]);
+}
+
+/*
+ * printjson - Print the results, with the build and host they came
+ *    from, as one JSON object. Counters are totals over one replay of
+ *    the trace; divide by ops for the per-request figures. mm.c's
+ *    results are at the top level; mdriver-all puts those of the other
+ *    packages under "variants", keyed by name.
+ */
+static void printjson(FILE *fp, meta_t *meta, char **tracefiles, int n,
+		      stats_t *libc_stats, stats_t **all_stats,
+		      double (*all_perf)[3], int *all_errors, int num_allocs)
+{
+    int a;
+
+    fprintf(fp, "{\n  \"date\": ");
+    json_str(fp, meta->date);
+    fprintf(fp, ",\n  \"team\": ");
+    json_str(fp, team.teamname);
+    fprintf(fp, ",\n  \"build\": {\"compiler\": ");
+    json_str(fp, __VERSION__);
+    fprintf(fp, ", \"compiled\": ");
+    json_str(fp, __DATE__ " " __TIME__);
+    fprintf(fp, ", \"bits\": %d, \"timer\": ", (int)(8 * sizeof(void *)));
+    json_str(fp, meta->timer);
+    fprintf(fp, ", \"kernels\": ");
+    json_str(fp, meta->isa ? meta->isa : "");
+    if (meta->lat_timer != NULL) {
+	fprintf(fp, ", \"latency_timer\": ");
+	json_str(fp, meta->lat_timer);
+    }
+    fprintf(fp, "},\n  \"host\": {\"name\": ");
+    json_str(fp, meta->host.nodename);
+    fprintf(fp, ", \"os\": ");
+    json_str(fp, meta->host.sysname);
+    fprintf(fp, ", \"release\": ");
+    json_str(fp, meta->host.release);
+    fprintf(fp, ", \"arch\": ");
+    json_str(fp, meta->host.machine);
+    fprintf(fp, ", \"cpu\": ");
+    json_str(fp, meta->cpu);
+    fprintf(fp, ", \"cpus\": %ld},\n", meta->cpus);
+
+    fprintf(fp, "  \"mm\": ");
+    json_traces(fp, meta, tracefiles, n, all_stats[0], 1);
+    if (libc_stats != NULL) {
+	fprintf(fp, ",\n  \"libc\": ");
+	json_traces(fp, meta, tracefiles, n, libc_stats, 0);
+    }
+    json_total(fp, "  ", n, all_stats[0], all_errors[0], all_perf[0]);
+
+    if (num_allocs > 1) {
+	fprintf(fp, ",\n  \"variants\": {");
+	for (a = 1; a < num_allocs; a++) {
+	    fprintf(fp, "%s\n  ", a > 1 ? "," : "");
+	    json_str(fp, mm_allocs[a].name);
+	    fprintf(fp, ": {\"traces\": ");
+	    json_traces(fp, meta, tracefiles, n, all_stats[a], 1);
+	    json_total(fp, "   ", n, all_stats[a], all_errors[a], all_perf[a]);
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "\n  }");
+    }
+    fprintf(fp, "\n}\n");
+}
+
+/* csv_str - Print s as a CSV field, quoted if it has to be */
+static void csv_str(FILE *fp, const char *s)
+{
+    if (strpbrk(s, ",\"\n") == NULL) {
+	fputs(s, fp);
+	return;
+    }
+    putc('"', fp);
+    for (; *s != '\0'; s++) {
+	if (*s == '"')
+	    putc('"', fp);
+	putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/* csv_num - Print v, or an empty field if it is negative (not measured) */
+static void csv_num(FILE *fp, double v)
+{
+    if (v >= 0)
+	fprintf(fp, "%.9g", v);
+}
+
+/*
+ * csv_row - Print the CSV row of one trace, or of the total when file
+ *    is NULL. The build and host columns repeat on every row, so rows
+ *    from many runs can go in one table.
+ */
+static void csv_row(FILE *fp, meta_t *meta, const char *alloc, int trace,
+		    const char *file, stats_t *s, int latency, double perfidx)
+{
+    int k;
+
+    fprintf(fp, "%s,", alloc);
+    if (file == NULL)
+	fprintf(fp, "all,,");
+    else {
+	fprintf(fp, "%d,", trace);
+	csv_str(fp, file);
+	putc(',', fp);
+    }
+    fprintf(fp, "%d,%.0f,", s->valid, s->ops);
+    csv_num(fp, s->valid ? s->secs : -1);
+    putc(',', fp);
+    csv_num(fp, s->valid && s->secs > 0 ? s->ops / 1e3 / s->secs : -1);
+    putc(',', fp);
+    csv_num(fp, s->valid && strcmp(alloc, "libc") != 0 ? s->util : -1);
+    if (latency)
+	for (k = ALLOC; k <= REALLOC; k++) {
+	    if (s->lat == NULL || s->lat[k].total == 0)
+		fprintf(fp, ",,,,,");
+	    else
+		fprintf(fp, ",%llu,%.0f,%.0f,%.0f,%.0f",
+			(unsigned long long)s->lat[k].total,
+			lat_quantile(&s->lat[k], 0.5),
+			lat_quantile(&s->lat[k], 0.99),
+			lat_quantile(&s->lat[k], 0.999),
+			lat_quantile(&s->lat[k], 1.0));
+	}
+    if (meta->counters)
+	for (k = 0; k < PC_NUM; k++) {
+	    putc(',', fp);
+	    if (strcmp(alloc, "libc") != 0 && s->valid)
+		csv_num(fp, s->ctr[k]);
+	}
+    putc(',', fp);
+    csv_num(fp, perfidx);
+    fprintf(fp, ",%s,", meta->date);
+    csv_str(fp, meta->host.nodename);
+    fprintf(fp, ",%s %s,%s,", meta->host.sysname, meta->host.release,
+	    meta->host.machine);
+    csv_str(fp, meta->cpu);
+    fprintf(fp, ",%ld,", meta->cpus);
+    csv_str(fp, __VERSION__);
+    fprintf(fp, ",%d,%s,%s\n", (int)(8 * sizeof(void *)), meta->timer,
+	    meta->isa ? meta->isa : "");
+}
+
+/*
+ * printcsv - Print the results as CSV: a header, a row per trace for
+ *    each malloc package run, and a total row for each mm package that
+ *    carries its perf index. Counters are totals over one replay of the
+ *    trace.
+ */
+static void printcsv(FILE *fp, meta_t *meta, char **tracefiles, int n,
+		     stats_t *libc_stats, stats_t **all_stats,
+		     double (*all_perf)[3], int *all_errors, int num_allocs)
+{
+    static const char *names[] = {"malloc", "free", "realloc"};
+    stats_t total, *mm_stats;
+    const char *alloc;
+    int a, i, k, latency = (meta->lat_timer != NULL);
+
+    fprintf(fp, "alloc,trace,file,valid,ops,secs,kops,util");
+    if (latency)
+	for (k = ALLOC; k <= REALLOC; k++)
+	    fprintf(fp, ",%s_count,%s_p50_ns,%s_p99_ns,%s_p99.9_ns,%s_max_ns",
+		    names[k], names[k], names[k], names[k], names[k]);
+    if (meta->counters)
+	for (k = 0; k < PC_NUM; k++)
+	    fprintf(fp, ",%s", pc_names[k]);
+    fprintf(fp, ",perfidx,date,host,os,arch,cpu,cpus,compiler,bits,timer,"
+	    "kernels\n");
+
+    for (i = 0; libc_stats != NULL && i < n; i++)
+	csv_row(fp, meta, "libc", i, tracefiles[i], &libc_stats[i], latency,
+		-1);
+    for (a = 0; a < num_allocs; a++) {
+	alloc = mm_allocs[a].name;
+	mm_stats = all_stats[a];
+	for (i = 0; i < n; i++)
+	    csv_row(fp, meta, alloc, i, tracefiles[i], &mm_stats[i], latency,
+		    -1);
+
+	memset(&total, 0, sizeof(total));
+	total.valid = (all_errors[a] == 0);
+	for (k = 0; k < PC_NUM; k++)
+	    total.ctr[k] = 0;
+	for (i = 0; i < n; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    total.ops += mm_stats[i].ops;
+	    total.secs += mm_stats[i].secs;
+	    total.util += mm_stats[i].util / n;
+	    for (k = 0; k < PC_NUM; k++)
+		if (total.ctr[k] >= 0)
+		    total.ctr[k] = (mm_stats[i].ctr[k] < 0) ? -1 :
+			total.ctr[k] + mm_stats[i].ctr[k];
+	}
+	csv_row(fp, meta, alloc, 0, NULL, &total, latency, all_perf[a][2]);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -993,10 +2554,10 @@ void unix_error(char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(int tracenum, long opnum, char *msg)
 {
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    printf("ERROR [trace %d, line %ld]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
 /* 
@@ -1004,13 +2565,23 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValsHP] [-f <file>] [-t <dir>] [-M <bytes>] [-j <n>]\n"
+		    "               [-k <n> [--split]] [--format=<text|json|csv>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
-    fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as the trace file (.rep or binary).\n");
+    fprintf(stderr, "\t--format=<f>  Write the results to stdout as text, json or csv;\n");
+    fprintf(stderr, "\t           with json or csv the rest goes to stderr.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print request latency percentiles.\n");
+    fprintf(stderr, "\t-j <n>     Check <n> traces at once (0: one per CPU).\n");
+    fprintf(stderr, "\t-k <n>     Replay on 1 to <n> threads sharing one heap (0: one per CPU).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-M <bytes> Map mm requests of at least <bytes> on their own.\n");
+    fprintf(stderr, "\t-P         Count hardware events per request.\n");
+    fprintf(stderr, "\t-s         Stream traces from disk instead of loading them.\n");
+    fprintf(stderr, "\t--split    With -k, split each trace among the threads.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
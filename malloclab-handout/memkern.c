@@ -0,0 +1,116 @@
+/*
+ * memkern.c - Fill kernel for the driver
+ *
+ * memcpy and memset from the C library are as fast as hand-written
+ * vector loops at every size that fits in the cache, so only the fill
+ * of a region bigger than the last level cache has a kernel of its
+ * own: a non-temporal store loop, SSE2 or AVX2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memkern.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+/* Used when the cache size cannot be read from the system */
+#define DEFAULT_LLC  (8 * (1 << 20))
+
+static size_t nt_threshold = 0;   /* non-temporal from here; 0 = not set */
+static void *fill_c(void *dst, int c, size_t n);
+static void *(*fill_nt)(void *dst, int c, size_t n) = fill_c;
+
+static void *fill_c(void *dst, int c, size_t n)
+{
+    return memset(dst, c, n);
+}
+
+#ifdef HAVE_X86
+
+/*
+ * fill_sse2, fill_avx2 - Non-temporal fills, for n well above the
+ *     vector width; the unaligned head and tail use ordinary stores
+ */
+__attribute__((target("sse2")))
+static void *fill_sse2(void *dst, int c, size_t n)
+{
+    char *d = dst;
+    __m128i v = _mm_set1_epi8((char)c);
+    size_t head = (-(uintptr_t)d) & 15;
+
+    _mm_storeu_si128((__m128i *)d, v);
+    d += head; n -= head;
+    for (; n >= 16; n -= 16, d += 16)
+        _mm_stream_si128((__m128i *)d, v);
+    _mm_sfence();
+    if (n > 0)
+        _mm_storeu_si128((__m128i *)(d + n - 16), v);
+    return dst;
+}
+
+__attribute__((target("avx2")))
+static void *fill_avx2(void *dst, int c, size_t n)
+{
+    char *d = dst;
+    __m256i v = _mm256_set1_epi8((char)c);
+    size_t head = (-(uintptr_t)d) & 31;
+
+    _mm256_storeu_si256((__m256i *)d, v);
+    d += head; n -= head;
+    for (; n >= 32; n -= 32, d += 32)
+        _mm256_stream_si256((__m256i *)d, v);
+    _mm_sfence();
+    if (n > 0)
+        _mm256_storeu_si256((__m256i *)(d + n - 32), v);
+    return dst;
+}
+
+#endif /* HAVE_X86 */
+
+/*
+ * mk_init - Read the cache size and pick the widest non-temporal fill
+ *     the CPU has
+ */
+const char *mk_init(void)
+{
+    const char *isa = "c";
+    long llc = -1;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    fill_nt = fill_c;
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fill_nt = fill_avx2;
+        isa = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        fill_nt = fill_sse2;
+        isa = "sse2";
+    }
+#endif
+    nt_threshold = (llc > 0) ? (size_t)llc : DEFAULT_LLC;
+    return isa;
+}
+
+size_t mk_threshold(void)
+{
+    if (nt_threshold == 0)
+        mk_init();
+    return nt_threshold;
+}
+
+void *mk_fill(void *dst, int c, size_t n)
+{
+    if (n < mk_threshold())
+        return memset(dst, c, n);
+    return fill_nt(dst, c, n);
+}
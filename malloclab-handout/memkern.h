@@ -0,0 +1,18 @@
+/*
+ * memkern.h - Fill kernel for the driver
+ *
+ * Fills below the last level cache size are plain memset. Bigger ones
+ * use non-temporal stores (SSE2 or AVX2, picked on first use), which
+ * mkbench shows beat memset there; cached stores would only evict the
+ * working set.
+ */
+#include <stddef.h>
+
+/* Set n bytes to c, like memset */
+void *mk_fill(void *dst, int c, size_t n);
+
+/* Pick the kernel now; returns the name of the instruction set used */
+const char *mk_init(void);
+
+/* Fills of at least this many bytes bypass the cache */
+size_t mk_threshold(void);
@@ -2,7 +2,12 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * All state lives in a mem_heap_t, so several heaps can exist side by
+ * side. The mem_* functions without a heap argument work on a default
+ * heap set up by mem_init.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +19,86 @@
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * The heap is a list of segments. Each reserves address space in
+ * SEG_BYTES steps and is only backed as it is touched. mem_sbrk moves
+ * the brk of the newest segment, growing its reservation in place
+ * while the next range is free; when it is not, the allocator starts
+ * a new segment with mem_segment. Segments are never contiguous with
+ * each other, so the allocator fences each one off.
+ */
+#define SEG_BYTES (64*(1<<20))  /* reservation step */
+#define MAX_SEGS  256
+
+typedef struct {
+    char *lo;                /* first byte of the segment */
+    char *brk;               /* one past its last heap byte */
+    char *max;               /* one past its reservation */
+} segment_t;
+
+/* live mappings made by mem_map, so ranges in them can be checked */
+typedef struct {
+    char *lo;
+    size_t size;
+} mapping_t;
+
+struct mem_heap {
+    segment_t segs[MAX_SEGS];  /* segments, oldest first */
+    int num_segs;              /* segments in use */
+    size_t heap_bytes;         /* sum of brk - lo over the segments */
+    size_t heap_limit;         /* most heap bytes handed out */
+
+    mapping_t *maps;           /* table of live mappings */
+    int num_maps;              /* entries in use */
+    int max_maps;              /* entries allocated */
+    size_t map_bytes;          /* bytes currently mapped */
+    size_t map_peak;           /* high water of map_bytes since reset */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_heap_t default_heap;  /* heap behind mem_init, mem_sbrk, ... */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+#define HEAP_MAP_FLAGS (MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE)
+
+/*
+ * mm.c links blocks with 32-bit words, so on x86-64 segments have to
+ * be placed below 4 GB; they are fitted in from LOW_START up
+ */
+#ifdef __x86_64__
+#define LOW_START 0x10000000UL
+#define LOW_END   0x100000000UL
+#endif
+
+static int heap_setup(mem_heap_t *m, size_t max_heap);
+static void heap_teardown(mem_heap_t *m);
+static int find_map(mem_heap_t *m, void *p);
+static void grow_maps(mem_heap_t *m);
+static char *reserve(size_t size);
+static char *reserve_at(char *addr, size_t size);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_init_size(MAX_HEAP);
+}
+
+/*
+ * mem_init_size - initialize the model with a heap of at most max_heap
+ *    bytes. Only the first segment is reserved now. memlib never calls
+ *    malloc, so it can also sit under an interposed malloc (see
+ *    mmpreload.c).
+ */
+void mem_init_size(size_t max_heap)
+{
+    if (heap_setup(&default_heap, max_heap) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,57 +106,244 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    heap_teardown(&default_heap);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_default - the heap the functions without a heap argument use
  */
-void mem_reset_brk()
+mem_heap_t *mem_default(void)
 {
-    mem_brk = mem_start_brk;
+    return &default_heap;
+}
+
+/*
+ * mem_heap_create - make another heap of at most max_heap bytes, with
+ *    its state in a mapping of its own. Returns NULL on failure.
+ */
+mem_heap_t *mem_heap_create(size_t max_heap)
+{
+    mem_heap_t *m;
+
+    m = mmap(NULL, sizeof(mem_heap_t), PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+	return NULL;
+    if (heap_setup(m, max_heap) < 0) {
+	munmap(m, sizeof(mem_heap_t));
+	return NULL;
+    }
+    return m;
+}
+
+/*
+ * mem_heap_destroy - release a heap from mem_heap_create and all its
+ *    memory
+ */
+void mem_heap_destroy(mem_heap_t *m)
+{
+    heap_teardown(m);
+    munmap(m, sizeof(mem_heap_t));
+}
+
+/*
+ * mem_heap_reset - reset the simulated brk pointer to make an empty heap
+ *    and drop any mappings left over from the last run. The first
+ *    segment stays reserved.
+ */
+void mem_heap_reset(mem_heap_t *m)
+{
+    segment_t *s;
+
+    while (m->num_segs > 1) {
+	s = &m->segs[--m->num_segs];
+	munmap(s->lo, s->max - s->lo);
+    }
+    m->segs[0].brk = m->segs[0].lo;
+    m->heap_bytes = 0;
+    while (m->num_maps > 0) {
+        m->num_maps--;
+        munmap(m->maps[m->num_maps].lo, m->maps[m->num_maps].size);
+    }
+    m->map_bytes = m->map_peak = 0;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ * mem_heap_sbrk - simple model of the sbrk function. Extends the newest
+ *    segment by incr bytes and returns the start address of the new
+ *    area. A negative incr gives the top -incr bytes back to the model.
+ *    Fails quietly if the segment cannot grow in place, so the caller
+ *    can go on with mem_heap_segment.
  */
-void *mem_sbrk(int incr) 
+void *mem_heap_sbrk(mem_heap_t *m, ptrdiff_t incr) 
 {
-    char *old_brk = mem_brk;
+    segment_t *s = &m->segs[m->num_segs - 1];
+    char *old_brk = s->brk;
+    size_t grow;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((incr < 0 && -incr > s->brk - s->lo) ||
+	(incr > 0 && m->heap_bytes + incr > m->heap_limit)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    if (incr > s->max - s->brk) {
+	grow = ((incr - (s->max - s->brk)) + SEG_BYTES - 1) / SEG_BYTES * SEG_BYTES;
+	if (reserve_at(s->max, grow) == NULL) {
+	    errno = ENOMEM;
+	    return (void *)-1;
+	}
+	s->max += grow;
+    }
+    s->brk += incr;
+    m->heap_bytes += incr;
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_heap_segment - start a new segment with size bytes of heap and
+ *    return its first byte, or NULL. Later sbrk calls grow this segment.
  */
-void *mem_heap_lo()
+void *mem_heap_segment(mem_heap_t *m, size_t size)
 {
-    return (void *)mem_start_brk;
+    size_t len = (size + SEG_BYTES - 1) / SEG_BYTES * SEG_BYTES;
+    segment_t *s;
+
+    if (m->num_segs == MAX_SEGS || m->heap_bytes + size > m->heap_limit) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_segment failed. Ran out of memory...\n");
+	return NULL;
+    }
+    s = &m->segs[m->num_segs];
+    if ((s->lo = reserve(len)) == NULL)
+	return NULL;
+    s->brk = s->lo + size;
+    s->max = s->lo + len;
+    m->num_segs++;
+    m->heap_bytes += size;
+    return s->lo;
+}
+
+/*
+ * mem_heap_segment_next - first byte of the segment made after the one
+ *    holding p, or NULL if that is the newest
+ */
+void *mem_heap_segment_next(mem_heap_t *m, void *p)
+{
+    int i;
+
+    for (i = 0; i < m->num_segs - 1; i++)
+	if ((char *)p >= m->segs[i].lo && (char *)p < m->segs[i].brk)
+	    return m->segs[i+1].lo;
+    return NULL;
+}
+
+/*
+ * mem_heap_first - address of the first heap byte
+ */
+void *mem_heap_first(mem_heap_t *m)
+{
+    return (void *)m->segs[0].lo;
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_last - address of the last heap byte, in the newest segment
  */
-void *mem_heap_hi()
+void *mem_heap_last(mem_heap_t *m)
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(m->segs[m->num_segs - 1].brk - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heap_bytes - heap size in bytes, over all segments
  */
-size_t mem_heapsize() 
+size_t mem_heap_bytes(mem_heap_t *m)
+{
+    return m->heap_bytes;
+}
+
+/*
+ * mem_heap_map - map size bytes (a multiple of the page size) of fresh
+ *    memory outside the heap. Returns NULL if the system refuses.
+ */
+void *mem_heap_map(mem_heap_t *m, size_t size)
+{
+    char *p;
+
+    if (m->num_maps == m->max_maps)
+	grow_maps(m);
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+
+    m->maps[m->num_maps].lo = p;
+    m->maps[m->num_maps].size = size;
+    m->num_maps++;
+    m->map_bytes += size;
+    if (m->map_bytes > m->map_peak)
+	m->map_peak = m->map_bytes;
+    return p;
+}
+
+/*
+ * mem_heap_remap - resize a mapping from mem_heap_map, moving it if
+ *    needed. The kernel moves the pages, the contents are not copied.
+ */
+void *mem_heap_remap(mem_heap_t *m, void *p, size_t oldsize, size_t newsize)
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    int i = find_map(m, p);
+    char *newp;
+
+    assert(i >= 0 && m->maps[i].size == oldsize);
+    newp = mremap(p, oldsize, newsize, MREMAP_MAYMOVE);
+    if (newp == MAP_FAILED)
+	return NULL;
+
+    m->maps[i].lo = newp;
+    m->maps[i].size = newsize;
+    m->map_bytes += newsize - oldsize;
+    if (m->map_bytes > m->map_peak)
+	m->map_peak = m->map_bytes;
+    return newp;
+}
+
+/*
+ * mem_heap_unmap - release a mapping from mem_heap_map
+ */
+void mem_heap_unmap(mem_heap_t *m, void *p, size_t size)
+{
+    int i = find_map(m, p);
+
+    assert(i >= 0 && m->maps[i].size == size);
+    munmap(p, size);
+    m->maps[i] = m->maps[--m->num_maps];
+    m->map_bytes -= size;
+}
+
+/*
+ * mem_heap_mapped - high water mark of mapped bytes since the last reset
+ */
+size_t mem_heap_mapped(mem_heap_t *m)
+{
+    return m->map_peak;
+}
+
+/*
+ * mem_heap_contains - true if [lo, hi] lies inside a single heap segment
+ *    or a single live mapping
+ */
+int mem_heap_contains(mem_heap_t *m, void *lo, void *hi)
+{
+    int i;
+
+    for (i = 0; i < m->num_segs; i++)
+	if ((char *)lo >= m->segs[i].lo && (char *)hi < m->segs[i].brk)
+	    return 1;
+    for (i = 0; i < m->num_maps; i++)
+	if ((char *)lo >= m->maps[i].lo &&
+	    (char *)hi < m->maps[i].lo + m->maps[i].size)
+	    return 1;
+    return 0;
 }
 
 /*
@@ -99,3 +353,172 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * The original memlib interface, on the default heap
+ */
+void mem_reset_brk()
+{
+    mem_heap_reset(&default_heap);
+}
+
+void *mem_sbrk(ptrdiff_t incr)
+{
+    return mem_heap_sbrk(&default_heap, incr);
+}
+
+void *mem_segment(size_t size)
+{
+    return mem_heap_segment(&default_heap, size);
+}
+
+void *mem_segment_next(void *p)
+{
+    return mem_heap_segment_next(&default_heap, p);
+}
+
+void *mem_heap_lo()
+{
+    return mem_heap_first(&default_heap);
+}
+
+void *mem_heap_hi()
+{
+    return mem_heap_last(&default_heap);
+}
+
+size_t mem_heapsize() 
+{
+    return mem_heap_bytes(&default_heap);
+}
+
+void *mem_map(size_t size)
+{
+    return mem_heap_map(&default_heap, size);
+}
+
+void *mem_remap(void *p, size_t oldsize, size_t newsize)
+{
+    return mem_heap_remap(&default_heap, p, oldsize, newsize);
+}
+
+void mem_unmap(void *p, size_t size)
+{
+    mem_heap_unmap(&default_heap, p, size);
+}
+
+size_t mem_mapsize()
+{
+    return mem_heap_mapped(&default_heap);
+}
+
+int mem_contains(void *lo, void *hi)
+{
+    return mem_heap_contains(&default_heap, lo, hi);
+}
+
+/*
+ * heap_setup - reserve the first segment of an empty heap
+ */
+static int heap_setup(mem_heap_t *m, size_t max_heap)
+{
+    size_t size = (max_heap < SEG_BYTES) ? max_heap : SEG_BYTES;
+
+    memset(m, 0, sizeof(mem_heap_t));
+    /* reserve the storage we will use to model the available VM */
+    if ((m->segs[0].lo = reserve(size)) == NULL)
+	return -1;
+    m->segs[0].brk = m->segs[0].lo;         /* heap is empty initially */
+    m->segs[0].max = m->segs[0].lo + size;
+    m->num_segs = 1;
+    m->heap_limit = max_heap;
+    return 0;
+}
+
+/*
+ * heap_teardown - unmap every segment, mapping and the mapping table
+ */
+static void heap_teardown(mem_heap_t *m)
+{
+    mem_heap_reset(m);
+    munmap(m->segs[0].lo, m->segs[0].max - m->segs[0].lo);
+    m->num_segs = 0;
+    if (m->maps != NULL)
+	munmap(m->maps, m->max_maps * sizeof(mapping_t));
+    m->maps = NULL;
+    m->max_maps = 0;
+}
+
+/*
+ * reserve - reserve size bytes of heap address space anywhere it fits
+ */
+static char *reserve(size_t size)
+{
+#ifdef __x86_64__
+    unsigned long a;
+    char *p;
+
+    for (a = LOW_START; a + size <= LOW_END; a += SEG_BYTES)
+	if ((p = reserve_at((char *)a, size)) != NULL)
+	    return p;
+    return NULL;
+#else
+    char *p = mmap(NULL, size, PROT_READ|PROT_WRITE, HEAP_MAP_FLAGS, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+#endif
+}
+
+/*
+ * reserve_at - reserve exactly [addr, addr+size), or return NULL if
+ *    any of it is taken
+ */
+static char *reserve_at(char *addr, size_t size)
+{
+    char *p = mmap(addr, size, PROT_READ|PROT_WRITE,
+		   HEAP_MAP_FLAGS|MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (p == MAP_FAILED)
+	return NULL;
+    if (p != addr) {		/* old kernel took the address as a hint */
+	munmap(p, size);
+	return NULL;
+    }
+    return p;
+}
+
+/*
+ * grow_maps - double the mapping table, which lives in a mapping of
+ *    its own
+ */
+static void grow_maps(mem_heap_t *m)
+{
+    size_t oldsize = m->max_maps * sizeof(mapping_t);
+    size_t newsize = oldsize ? 2 * oldsize : mem_pagesize();
+    void *p;
+
+    if (m->maps == NULL)
+	p = mmap(NULL, newsize, PROT_READ|PROT_WRITE,
+		 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    else
+	p = mremap(m->maps, oldsize, newsize, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mem_map: mmap error\n");
+	exit(1);
+    }
+    m->maps = p;
+    m->max_maps = newsize / sizeof(mapping_t);
+}
+
+/*
+ * find_map - index of the mapping starting at p, or -1
+ */
+static int find_map(mem_heap_t *m, void *p)
+{
+    int i;
+
+    for (i = 0; i < m->num_maps; i++)
+	if (m->maps[i].lo == p)
+	    return i;
+    return -1;
+}
@@ -1,11 +1,45 @@
 #include <unistd.h>
+#include <stddef.h>
 
-void mem_init(void);               
+void mem_init(void);
+void mem_init_size(size_t max_heap);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void *mem_sbrk(ptrdiff_t incr);
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* The heap grows in segments that are not contiguous with each other */
+void *mem_segment(size_t size);
+void *mem_segment_next(void *p);
+
+/* Page-aligned mappings that live outside the sbrk heap */
+void *mem_map(size_t size);
+void *mem_remap(void *p, size_t oldsize, size_t newsize);
+void mem_unmap(void *p, size_t size);
+size_t mem_mapsize(void);
+int mem_contains(void *lo, void *hi);
+
+/*
+ * Heap instances. The functions above work on the default heap; each
+ * has a mem_heap_* counterpart taking the heap to work on.
+ */
+typedef struct mem_heap mem_heap_t;
+
+mem_heap_t *mem_default(void);
+mem_heap_t *mem_heap_create(size_t max_heap);
+void mem_heap_destroy(mem_heap_t *m);
+void mem_heap_reset(mem_heap_t *m);
+void *mem_heap_sbrk(mem_heap_t *m, ptrdiff_t incr);
+void *mem_heap_segment(mem_heap_t *m, size_t size);
+void *mem_heap_segment_next(mem_heap_t *m, void *p);
+void *mem_heap_first(mem_heap_t *m);
+void *mem_heap_last(mem_heap_t *m);
+size_t mem_heap_bytes(mem_heap_t *m);
+void *mem_heap_map(mem_heap_t *m, size_t size);
+void *mem_heap_remap(mem_heap_t *m, void *p, size_t oldsize, size_t newsize);
+void mem_heap_unmap(mem_heap_t *m, void *p, size_t size);
+size_t mem_heap_mapped(mem_heap_t *m);
+int mem_heap_contains(mem_heap_t *m, void *lo, void *hi);
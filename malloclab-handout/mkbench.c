@@ -0,0 +1,73 @@
+/*
+ * mkbench.c - Compare mk_fill with memset
+ *
+ * Fills buffers from well inside the cache to well past the last level
+ * cache with both, best of several runs, and prints GB/s. mk_fill only
+ * differs from memset from mk_threshold() bytes up; this is the check
+ * that its non-temporal kernel earns its keep there.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memkern.h"
+
+#define RUNS      5               /* best of RUNS */
+#define VOLUME    (1L << 30)      /* bytes filled per run */
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Best GB/s of fill() over RUNS runs of reps fills of n bytes */
+static double rate(void *(*fill)(void *, int, size_t), char *buf, size_t n,
+		   long reps)
+{
+    double best = 1e30, t;
+    long i;
+    int r;
+
+    for (r = 0; r < RUNS; r++) {
+	t = now();
+	for (i = 0; i < reps; i++) {
+	    fill(buf, r, n);
+	    __asm__ volatile("" : : "r"(buf) : "memory");
+	}
+	t = now() - t;
+	if (t < best)
+	    best = t;
+    }
+    return (double)n * reps / best / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    size_t llc, n, top;
+    long reps;
+    char *buf;
+    const char *isa = mk_init();
+
+    llc = mk_threshold();
+    top = (argc > 1) ? (size_t)atol(argv[1]) << 20 : 4 * llc;
+    printf("kernel %s, non-temporal from %zu bytes\n", isa, llc);
+    printf("%12s %10s %10s\n", "bytes", "memset", "mk_fill");
+    if ((buf = malloc(top)) == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    memset(buf, 0, top);
+    for (n = 4096; n <= top; n *= 4) {
+	reps = VOLUME / (long)n;
+	if (reps < 3)
+	    reps = 3;
+	printf("%12zu %10.2f %10.2f\n", n, rate(memset, buf, n, reps),
+	       rate(mk_fill, buf, n, reps));
+    }
+    free(buf);
+    return 0;
+}
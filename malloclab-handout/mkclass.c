@@ -0,0 +1,106 @@
+/*
+ * mkclass.c - Generate mm_class.h, the size-to-class table used by mm.c
+ *
+ * With no arguments the classes are the powers of two mm.c has always
+ * used. Given one or more .rep traces as a profile, the eight classes
+ * below LUT_MAX are instead cut so each holds about the same share of
+ * the profiled requests; blocks of LUT_MAX bytes and up stay in the
+ * last class.
+ *
+ * usage: mkclass [trace.rep ...] > mm_class.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NCLASSES  9            /* list heads laid out by mm_init */
+#define LUT_MAX   4096         /* sizes at or above go to the last class */
+#define LUT_LEN   (LUT_MAX/8)  /* one entry per 8-byte block size */
+#define MAXLINE   1024
+
+/* Block size mm_malloc uses for a request, as in mm.c */
+#define ASIZE(s)  ((s) <= 8 ? 16 : 8 * (((s) + 8 + 7) / 8))
+
+static double hist[LUT_LEN];   /* profiled requests per block size / 8 */
+
+/*
+ * read_profile - Add the alloc and realloc sizes of a trace to hist
+ */
+static int read_profile(char *path)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    unsigned id, size;
+    int n = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "mkclass: could not open %s\n", path);
+        exit(1);
+    }
+    while (fgets(line, MAXLINE, fp) != NULL) {
+        if ((line[0] == 'a' || line[0] == 'r') &&
+            sscanf(line + 1, "%u %u", &id, &size) == 2 &&
+            ASIZE(size) < LUT_MAX) {
+            hist[ASIZE(size) / 8] += 1;
+            n++;
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char lut[LUT_LEN];
+    unsigned bound[NCLASSES];  /* smallest block size of each class */
+    double total = 0, seen = 0;
+    int i, c, n = 0;
+
+    for (i = 1; i < argc; i++)
+        n += read_profile(argv[i]);
+
+    /* Default: class c > 0 starts at 16 << c, class 0 starts at 0 */
+    bound[0] = 0;
+    for (c = 1; c < NCLASSES; c++)
+        bound[c] = 16 << c;
+
+    /* With a profile: equal shares of the requests below LUT_MAX */
+    if (n > 0) {
+        for (i = 0; i < LUT_LEN; i++)
+            total += hist[i];
+        c = 1;
+        for (i = 0; i < LUT_LEN && c < NCLASSES - 1; i++) {
+            seen += hist[i];
+            if (seen >= total * c / (NCLASSES - 1))
+                bound[c++] = (i + 1) * 8;
+        }
+        for (; c < NCLASSES - 1; c++)  /* profile ran out of sizes */
+            bound[c] = bound[c-1] + 8;
+        bound[NCLASSES-1] = LUT_MAX;
+    }
+
+    for (i = 0, c = 0; i < LUT_LEN; i++) {
+        while (c < NCLASSES - 1 && i * 8 >= (int)bound[c+1])
+            c++;
+        lut[i] = c;
+    }
+
+    printf("/*\n * mm_class.h - size class table for mm.c, generated by mkclass");
+    printf("%s\n *\n", n > 0 ? " from a profile" : "");
+    for (c = 0; c < NCLASSES; c++) {
+        if (c < NCLASSES - 1)
+            printf(" * class %d: blocks of %u to %u bytes\n", c, bound[c],
+                   bound[c+1] - 1);
+        else
+            printf(" * class %d: blocks of %u bytes and up\n", c, bound[c]);
+    }
+    printf(" */\n");
+    printf("#define NCLASSES\t%d\n", NCLASSES);
+    printf("#define CLASS_LUT_MAX\t%d\n\n", LUT_MAX);
+    printf("static const unsigned char class_lut[%d] = {", LUT_LEN);
+    for (i = 0; i < LUT_LEN; i++)
+        printf("%s%d%s", (i % 16) ? "" : "\n    ", lut[i],
+               (i < LUT_LEN - 1) ? ((i % 16 == 15) ? "," : ", ") : "\n");
+    printf("};\n");
+    exit(0);
+}
@@ -1,12 +1,21 @@
 /* Optimization Segregated list + Best fit + Address order has 87/100 */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <sched.h>
+#if defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#endif
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_class.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -42,10 +51,28 @@ team_t team = {
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)	((size) | (alloc))
 
+/* 
+ * The top bits of a free block's header hold its size class, so list
+ * removal finds the list head without recomputing it. Blocks are
+ * therefore smaller than 256 MB: coalesce stops merging at SIZE_MASK,
+ * and a bigger free span stays split into several blocks.
+ */
+#define CLASS_SHIFT		28
+#define SIZE_MASK		0x0FFFFFF8
+#define GET_CLASS(p)	(GET(p) >> CLASS_SHIFT)
+
 /* Read the size and allocated fields from address p*/
-#define GET_SIZE(p)		(GET(p) & ~0x7)
+#define GET_SIZE(p)		(GET(p) & SIZE_MASK)
 #define GET_ALLOC(p)	(GET(p) & 0x1)	
 
+/* Spare header bit: block was handed out by mm_malloc_cacheline */
+#define CLINE_BIT		0x2
+#define GET_CLINE(p)	(GET(p) & CLINE_BIT)
+
+/* Spare header bit: block belongs to a handle and may be moved */
+#define MOVE_BIT		0x4
+#define GET_MOVE(p)		(GET(p) & MOVE_BIT)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)                      
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) 
@@ -62,57 +89,247 @@ team_t team = {
 #define PUT_SUCC(bp, val) 	(GET_SUCC(bp) = (unsigned int)(val))
 #define PUT_PRED(bp, val) 	(GET_PRED(bp) = (unsigned int)(val))
 
+/* 
+ * Copy of the block size kept beside succ and pred, so list walks read
+ * one line per node. For a minimum (16 bytes) block this word is the footer.
+ */
+#define FSIZEP(bp)			((char *)(bp) + DSIZE)
+#define GET_FSIZE(bp)		GET_SIZE(FSIZEP(bp))
+
+/* 
+ * A mapped block starts a mapping of its own: the first word holds the
+ * mapping length, then a header of size 0 (which no heap block has),
+ * then the payload. An aligned mapped block has its payload further in;
+ * MAP_SHIFTED is set in its length word and the word before that holds
+ * the payload's offset from the start of the mapping.
+ */
+#define MAP_SHIFTED		0x1
+#define MAPPED(bp)		(GET_SIZE(HDRP(bp)) == 0)
+#define MAP_OFF(bp)		((GET((char *)(bp) - DSIZE) & MAP_SHIFTED) ? \
+						 GET((char *)(bp) - 3*WSIZE) : DSIZE)
+#define MAP_BASE(bp)	((char *)(bp) - MAP_OFF(bp))
+#define MAP_LEN(bp)		(GET((char *)(bp) - DSIZE) & ~MAP_SHIFTED)
 
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) 	((DSIZE) * (((size) + (DSIZE) + (DSIZE-1)) / (DSIZE)))
 
+/* rounds size (or address) up to a multiple of power of two a */
+#define ROUNDUP(x, a)	(((size_t)(x) + ((a)-1)) & ~((size_t)(a)-1))
+
+/* Handle slots are carved from ordinary blocks of this many slots */
+#define HSLOTS		64
+
+/* 
+ * A region owns a list of chunks; the first double word of each chunk
+ * links to the previous one. Requests bigger than REGION_BIG get a
+ * chunk of their own on the big list so the current chunk is kept.
+ */
+#define REGION_CHUNK	(CHUNKSIZE - DSIZE)
+#define REGION_BIG		(REGION_CHUNK / 4)
+#define CHUNK_NEXT(c)	(*(char **)(c))
+
+struct mm_region {
+    mm_heap_t *heap;	/* heap the chunks come from */
+    char *chunk;	/* current chunk, head of the chunk list */
+    char *big;		/* chunks holding one big request each */
+    char *cur;		/* next free byte in current chunk */
+    char *end;		/* end of current chunk */
+};
+
+/* 
+ * A pool cuts slabs of at least POOL_SLAB bytes into equal slots. Slabs
+ * are chained through their first double word like region chunks; a
+ * free slot holds the address of the next free slot.
+ */
+#define POOL_SLAB		(4 * CHUNKSIZE - DSIZE)
+#define POOL_MINOBJS	8
+#define SLOT_NEXT(s)	(*(void **)(s))
+
+struct mm_pool {
+    mm_heap_t *heap;	/* heap the slabs come from */
+    void *free;		/* first free slot */
+    char *slabs;	/* slab list */
+    size_t size;	/* slot size, a multiple of align */
+    size_t align;	/* slot alignment, a power of two */
+};
+
+/* 
+ * Front end caches hold allocated blocks of CACHE_CLASSES sizes, 16 to
+ * 136 bytes, CACHE_DEPTH per size. A miss or an overflow moves
+ * CACHE_BATCH blocks to or from the segregated lists under one lock.
+ */
+#define CACHE_CLASSES	16
+#define CACHE_DEPTH		32
+#define CACHE_BATCH		16
+#define CACHE_MAXBLOCK	(2*DSIZE + (CACHE_CLASSES-1)*DSIZE)
+#define CACHE_IDX(asize)	((asize)/DSIZE - 2)
+#define MM_MAXCPU		256
+
+typedef struct {
+    int lock;		/* taken in CPU mode only */
+    int count[CACHE_CLASSES];
+    void *slot[CACHE_CLASSES][CACHE_DEPTH];
+} cache_t;
+
+/* 
+ * Everything a heap needs lives in its mm_heap_t. mm_init and the other
+ * mm_* functions without a heap argument work on dflt_heap, which sits
+ * on memlib's default heap; mm_heap_init puts the mm_heap_t of another
+ * heap at the start of that heap's own memory.
+ */
+struct mm_heap {
+    mem_heap_t *mem;			/* memlib heap underneath */
+    char *heap_listp;			/* Pointer to first block */
+    char *block_list_start;		/* Pointer to first free block of different size */
+    mm_stats_t stats;			/* Counters reported by mm_stats */
+    void **hslot_free;			/* Unused handle slots, linked through themselves */
+    char *compact_cursor;		/* Block where the next compaction slice resumes */
+    char *seg_lo;				/* First byte of the newest memlib segment */
+    void *remote_head;			/* Blocks freed by other threads, linked through payload */
+    int cache_mode;				/* Front end selected by mm_cache_mode */
+    int core_lock;				/* Guards the lists when a cache mode is on */
+    unsigned gen;				/* Names this heap's thread caches, new per init */
+    size_t mmap_threshold;		/* Map requests at least this big, 0 = never */
+    cache_t *cpu_cache[MM_MAXCPU];	/* Per-CPU caches */
+    cache_t *held_cache[MM_MAXCPU];	/* CPU caches taken by mm_lock_all */
+};
+
+/* 
+ * A thread keeps its caches for up to TLS_HEAPS heaps. Using more heaps
+ * than that in MM_CACHE_THREAD mode evicts a cache; its blocks stay
+ * allocated in their heap until it is reset.
+ */
+#define TLS_HEAPS	4
+
+typedef struct {
+    unsigned gen;		/* gen of the heap the cache belongs to, 0 = none */
+    cache_t *cache;
+} tls_cache_t;
+
 /* Global variables */
-static char* heap_listp = 0;	/* Pointer to first block */
-static char* block_list_start  = 0;	/* Pointer to first free block of different size */	
+static mm_heap_t dflt_heap;				/* Heap behind the plain mm_* calls */
+static unsigned heap_gen = 0;			/* Last gen handed to a heap */
+static __thread tls_cache_t thread_cache[TLS_HEAPS];	/* Per-thread caches */
 
 /* Function prototypes for internal helper routines */
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize);
-static void *coalesce(void *bp);
+static int heap_setup(mm_heap_t *h);
+static void *extend_heap(mm_heap_t *h, size_t words);
+static void place(mm_heap_t *h, void *bp, size_t asize);
+static void *find_fit(mm_heap_t *h, size_t asize);
+static void *coalesce(mm_heap_t *h, void *bp);
+static void *alloc_aligned(mm_heap_t *h, size_t asize, size_t align);
+static void *slide(mm_heap_t *h, void *bp, void *hbp);
+static void trim(mm_heap_t *h);
+static char *region_chunk(mm_heap_t *h, size_t size);
+static void region_release(mm_heap_t *h, char *chunk);
+static void *pool_grow(mm_pool_t *p);
+static void drain_remote(mm_heap_t *h);
+static void *core_malloc(mm_heap_t *h, size_t size);
+static void core_free(mm_heap_t *h, void *ptr);
+static void *cache_malloc(mm_heap_t *h, size_t asize);
+static int cache_free(mm_heap_t *h, void *ptr, size_t asize);
+static cache_t **cache_slot(mm_heap_t *h, int create);
+static cache_t *cache_get(mm_heap_t *h);
+static void cache_put_back(mm_heap_t *h, cache_t *c, int idx, int n);
+static void spin_lock(int *lock);
+static void spin_unlock(int *lock);
+static void *map_alloc(mm_heap_t *h, size_t size);
+static void *map_alloc_aligned(mm_heap_t *h, size_t size, size_t align);
+static void *map_realloc(mm_heap_t *h, void *bp, size_t size);
+static size_t payload_size(void *bp);
 
-static void insert(void *new_first);
-static void remove_s_p(void *bp);
-void* get_sfreeh(size_t size);
+static void insert(mm_heap_t *h, void *new_first);
+static void remove_s_p(mm_heap_t *h, void *bp);
+void* get_sfreeh(mm_heap_t *h, size_t size);
 
 /* 
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
 {
-    if ((heap_listp = mem_sbrk(12*WSIZE)) == (void*)-1)
+    dflt_heap.mem = mem_default();
+    return heap_setup(&dflt_heap);
+}
+
+/*
+ * mm_heap_init - Start a heap on memlib heap mem, which should be empty
+ *     (new or just reset). Its mm_heap_t takes the first bytes of mem.
+ */
+mm_heap_t *mm_heap_init(mem_heap_t *mem)
+{
+    mm_heap_t *h;
+
+    if ((h = mem_heap_sbrk(mem, ROUNDUP(sizeof(mm_heap_t), DSIZE))) == (void*)-1)
+        return NULL;
+    memset(h, 0, sizeof(mm_heap_t));
+    h->mem = mem;
+    if (heap_setup(h) < 0)
+        return NULL;
+    return h;
+}
+
+/*
+ * heap_setup - Lay out the list heads, prologue and epilogue of an empty
+ *     heap. Cache mode and mmap threshold are kept.
+ */
+static int heap_setup(mm_heap_t *h)
+{
+    char *p;
+
+    if ((p = mem_heap_sbrk(h->mem, 12*WSIZE)) == (void*)-1)
         return -1;
-    PUT(heap_listp, 0);                         /* block size <= 32   */ 
-    PUT(heap_listp+(1*WSIZE), 0);               /* block size <= 64 */
-    PUT(heap_listp+(2*WSIZE), 0);               /* block size <= 128 */
-    PUT(heap_listp+(3*WSIZE), 0);               /* block size <= 256 */
-    PUT(heap_listp+(4*WSIZE), 0);               /* block size <= 512 */
-    PUT(heap_listp+(5*WSIZE), 0);               /* block size <= 1024 */
-    PUT(heap_listp+(6*WSIZE), 0);               /* block size <= 2048 */
-    PUT(heap_listp+(7*WSIZE), 0);               /* block size <= 4096 */
-    PUT(heap_listp+(8*WSIZE), 0);               /* block size > 4096 */
-    PUT(heap_listp+(9*WSIZE), PACK(DSIZE, 1));  /* Prologue header */ 
-    PUT(heap_listp+(10*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp+(11*WSIZE), PACK(0, 1));     /* Epilogue header */
+    PUT(p, 0);                          /* class 0 list head (mm_class.h) */ 
+    PUT(p+(1*WSIZE), 0);                /* class 1 list head */
+    PUT(p+(2*WSIZE), 0);                /* class 2 list head */
+    PUT(p+(3*WSIZE), 0);                /* class 3 list head */
+    PUT(p+(4*WSIZE), 0);                /* class 4 list head */
+    PUT(p+(5*WSIZE), 0);                /* class 5 list head */
+    PUT(p+(6*WSIZE), 0);                /* class 6 list head */
+    PUT(p+(7*WSIZE), 0);                /* class 7 list head */
+    PUT(p+(8*WSIZE), 0);                /* class 8 list head */
+    PUT(p+(9*WSIZE), PACK(DSIZE, 1));   /* Prologue header */ 
+    PUT(p+(10*WSIZE), PACK(DSIZE, 1));  /* Prologue footer */ 
+    PUT(p+(11*WSIZE), PACK(0, 1));      /* Epilogue header */
     
-    block_list_start = heap_listp;              /* pointer to block size <= 32   */ 
-    heap_listp += (10 * WSIZE);                 /* pointer to Prologue footer */
+    h->block_list_start = p;            /* pointer to class 0 list head */ 
+    h->heap_listp = p + (10 * WSIZE);   /* pointer to Prologue footer */
+    memset(&h->stats, 0, sizeof(h->stats));
+    h->hslot_free = NULL;
+    h->compact_cursor = NULL;
+    h->remote_head = NULL;
+    h->seg_lo = mem_heap_first(h->mem);
+    memset(h->cpu_cache, 0, sizeof(h->cpu_cache));
+    h->gen = __atomic_add_fetch(&heap_gen, 1, __ATOMIC_RELAXED);
 
-    if (extend_heap(2 * DSIZE/WSIZE) == NULL)   /* First Extend: Only require the 16 bytes */
+    if (extend_heap(h, 2 * DSIZE/WSIZE) == NULL)   /* First Extend: Only require the 16 bytes */
         return -1;
     return 0;
 }
 
 /* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * mm_heap_malloc - Serve small requests from the front end cache when
+ *     one is on; otherwise go to the segregated lists.
+ */
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+    void *bp;
+
+    if (h->cache_mode == MM_CACHE_OFF)
+        return core_malloc(h, size);
+    if (size != 0 && size <= CACHE_MAXBLOCK - DSIZE)
+        return cache_malloc(h, (size <= DSIZE) ? 2*DSIZE : ALIGN(size));
+
+    spin_lock(&h->core_lock);
+    bp = core_malloc(h, size);
+    spin_unlock(&h->core_lock);
+    return bp;
+}
+
+/* 
+ * core_malloc - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
  */
-void *mm_malloc(size_t size)
+static void *core_malloc(mm_heap_t *h, size_t size)
 {
     size_t asize;      /* Adjusted block size */
     size_t extendsize; /* Amount to extend heap if no fit */
@@ -122,64 +339,552 @@ void *mm_malloc(size_t size)
     if (size == 0)
         return NULL;
 
+    /* Take back what other threads freed before searching */
+    if (__atomic_load_n(&h->remote_head, __ATOMIC_RELAXED) != NULL)
+        drain_remote(h);
+
+    /* Huge requests live in a mapping of their own */
+    if (h->mmap_threshold && size >= h->mmap_threshold)
+        return map_alloc(h, size);
+
     /* Adjust block size to include overhead and alignment reqs. */
     if (size <= DSIZE)                                          
         asize = 2*DSIZE;                                        
     else
         asize = ALIGN(size); 
+    if (size > SIZE_MASK - DSIZE)       /* too big for a header */
+        return NULL;
 
     /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {  
-        place(bp, asize);                  
+    if ((bp = find_fit(h, asize)) != NULL) {  
+        place(h, bp, asize);                  
         return bp;
     }
 
     /* No fit found. Get more memory and place the block */
     extendsize = MAX(asize, CHUNKSIZE);                 
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
+    if ((bp = extend_heap(h, extendsize/WSIZE)) == NULL)  
         return NULL;                                  
-    place(bp, asize);                                 
+    place(h, bp, asize);                                 
     return bp;	
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_heap_malloc_cacheline - Allocate a block whose payload starts on a cache
+ *     line and is padded to whole lines, so it shares no line with the
+ *     payload of a neighbour. The header sits at the end of the line before.
  */
-void mm_free(void *ptr)
+void *mm_heap_malloc_cacheline(mm_heap_t *h, size_t size)
+{
+    size_t asize;
+    char *bp;
+
+    if (size == 0)
+        return NULL;
+
+    /* whole lines of payload plus header and footer */
+    asize = ROUNDUP(size, MM_CACHELINE) + DSIZE;
+    if (h->cache_mode != MM_CACHE_OFF)
+        spin_lock(&h->core_lock);
+    if ((bp = alloc_aligned(h, asize, MM_CACHELINE)) != NULL) {
+        PUT(HDRP(bp), GET(HDRP(bp)) | CLINE_BIT);
+        h->stats.cl_blocks++;
+        h->stats.cl_bytes += GET_SIZE(HDRP(bp));
+        h->stats.cl_overhead += GET_SIZE(HDRP(bp)) - ((size <= DSIZE) ? 2*DSIZE : ALIGN(size));
+    }
+    if (h->cache_mode != MM_CACHE_OFF)
+        spin_unlock(&h->core_lock);
+    return bp;
+}
+
+/*
+ * mm_heap_memalign - Allocate a block whose payload is aligned to align bytes,
+ *     a power of two. Alignments up to 8 are plain mm_malloc blocks, and
+ *     requests from the mmap threshold up get a mapping, as in mm_malloc.
+ */
+void *mm_heap_memalign(mm_heap_t *h, size_t align, size_t size)
+{
+    size_t asize;
+    void *bp;
+    int mapped = h->mmap_threshold && size >= h->mmap_threshold;
+
+    if (align <= ALIGNMENT)
+        return mm_heap_malloc(h, size);
+    if (size == 0)
+        return NULL;
+    if (!mapped && (size > SIZE_MASK/2 || align > SIZE_MASK/2 ||
+                    size + align > SIZE_MASK - 4*DSIZE))
+        return NULL;
+
+    asize = (size <= DSIZE) ? 2*DSIZE : ALIGN(size);
+    if (h->cache_mode != MM_CACHE_OFF)
+        spin_lock(&h->core_lock);
+    if (mapped)
+        bp = map_alloc_aligned(h, size, align);
+    else
+        bp = alloc_aligned(h, asize, align);
+    if (h->cache_mode != MM_CACHE_OFF)
+        spin_unlock(&h->core_lock);
+    return bp;
+}
+
+/*
+ * mm_usable_size - Payload bytes the caller may use in an allocated block
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    return payload_size(ptr);
+}
+
+/*
+ * mm_mapped - Nonzero if ptr is a block with a mapping of its own. Such a
+ *     block is zero when mm_malloc hands it out.
+ */
+int mm_mapped(void *ptr)
+{
+    return ptr != NULL && MAPPED(ptr);
+}
+
+/*
+ * mm_heap_stats - Copy out the allocator statistics
+ */
+void mm_heap_stats(mm_heap_t *h, mm_stats_t *st)
+{
+    *st = h->stats;
+}
+
+/*
+ * mm_heap_halloc - Allocate a movable block and return a handle to it. The
+ *     first double word of the block records the handle slot so the
+ *     compactor can fix it up; the caller's payload follows it.
+ */
+mm_handle_t mm_heap_halloc(mm_heap_t *h, size_t size)
+{
+    void **slot;
+    char *bp;
+    int i;
+
+    if (size == 0)
+        return NULL;
+
+    /* Refill the slot list from a new (never moved) block */
+    if (h->hslot_free == NULL) {
+        if ((slot = mm_heap_malloc(h, HSLOTS * sizeof(void *))) == NULL)
+            return NULL;
+        for (i = 0; i < HSLOTS - 1; i++)
+            slot[i] = &slot[i+1];
+        slot[HSLOTS-1] = NULL;
+        h->hslot_free = slot;
+    }
+
+    if ((bp = mm_heap_malloc(h, size + DSIZE)) == NULL)
+        return NULL;
+    slot = h->hslot_free;
+    h->hslot_free = *slot;
+
+    PUT(HDRP(bp), GET(HDRP(bp)) | MOVE_BIT);
+    PUT(bp, (unsigned int)slot);
+    *slot = bp + DSIZE;
+    h->stats.h_blocks++;
+    return slot;
+}
+
+/*
+ * mm_hderef - Current payload address of a handle
+ */
+void *mm_hderef(mm_handle_t handle)
+{
+    return *handle;
+}
+
+/*
+ * mm_heap_hfree - Free a handle block and recycle its slot
+ */
+void mm_heap_hfree(mm_heap_t *h, mm_handle_t handle)
+{
+    mm_heap_free(h, (char *)*handle - DSIZE);
+    *handle = h->hslot_free;
+    h->hslot_free = handle;
+    h->stats.h_blocks--;
+}
+
+/*
+ * mm_heap_hcompact - Run one slice of the incremental compactor. Walks the
+ *     heap from where the last slice stopped and slides every handle
+ *     block that follows a free block down over it, so free space bubbles
+ *     toward the top. Each slice does about budget bytes of copying and
+ *     scanning. The walk goes through the heap segments in turn; when it
+ *     reaches the last epilogue the free tail is trimmed off and 1 is
+ *     returned; otherwise 0.
+ */
+int mm_heap_hcompact(mm_heap_t *h, size_t budget)
+{
+    char *bp, *next;
+    size_t work = 0;
+    int done = 0;
+
+    if (h->cache_mode != MM_CACHE_OFF)
+        spin_lock(&h->core_lock);
+    bp = h->compact_cursor ? h->compact_cursor : NEXT_BLKP(h->heap_listp);
+    while (work < budget) {
+        if (GET_SIZE(HDRP(bp)) == 0) {      /* epilogue of a segment */
+            if ((next = mem_heap_segment_next(h->mem, HDRP(bp))) != NULL) {
+                bp = next + 4*WSIZE;        /* past the next prologue */
+                continue;
+            }
+            h->compact_cursor = NULL;
+            trim(h);
+            bp = NULL;
+            done = 1;
+            break;
+        }
+        next = NEXT_BLKP(bp);
+        if (!GET_ALLOC(HDRP(bp)) && GET_MOVE(HDRP(next))) {
+            work += GET_SIZE(HDRP(next));
+            bp = slide(h, bp, next);
+        }
+        else {
+            work += DSIZE;
+            bp = next;
+        }
+    }
+    h->compact_cursor = bp;
+    if (h->cache_mode != MM_CACHE_OFF)
+        spin_unlock(&h->core_lock);
+    return done;
+}
+
+/*
+ * mm_heap_region_create - Make an empty region; its first chunk is taken on
+ *     the first mm_region_alloc.
+ */
+mm_region_t *mm_heap_region_create(mm_heap_t *h)
+{
+    mm_region_t *r;
+
+    if ((r = mm_heap_malloc(h, sizeof(mm_region_t))) == NULL)
+        return NULL;
+    r->heap = h;
+    r->chunk = r->big = r->cur = r->end = NULL;
+    h->stats.r_regions++;
+    return r;
+}
+
+/*
+ * mm_region_alloc - Bump allocate size bytes, 8-byte aligned. Size 0
+ *     still takes 8 bytes, so every call returns a distinct pointer.
+ */
+void *mm_region_alloc(mm_region_t *r, size_t size)
+{
+    char *p;
+
+    if (size == 0)
+        size = DSIZE;
+    if (size > (size_t)-1 - DSIZE)
+        return NULL;
+    size = ROUNDUP(size, DSIZE);
+    if (size > REGION_BIG) {
+        if ((p = region_chunk(r->heap, size)) == NULL)
+            return NULL;
+        CHUNK_NEXT(p) = r->big;
+        r->big = p;
+        return p + DSIZE;
+    }
+
+    if ((size_t)(r->end - r->cur) < size) {
+        if ((p = region_chunk(r->heap, REGION_CHUNK)) == NULL)
+            return NULL;
+        CHUNK_NEXT(p) = r->chunk;
+        r->chunk = p;
+        r->cur = p + DSIZE;
+        r->end = r->cur + REGION_CHUNK;
+    }
+    p = r->cur;
+    r->cur += size;
+    return p;
+}
+
+/*
+ * mm_region_reset - Release everything allocated from r. The current
+ *     chunk is kept for reuse, the rest go back to mm_free.
+ */
+void mm_region_reset(mm_region_t *r)
+{
+    region_release(r->heap, r->big);
+    r->big = NULL;
+    if (r->chunk == NULL)
+        return;
+    region_release(r->heap, CHUNK_NEXT(r->chunk));
+    CHUNK_NEXT(r->chunk) = NULL;
+    r->cur = r->chunk + DSIZE;
+}
+
+/*
+ * mm_region_destroy - Release all chunks and the region itself
+ */
+void mm_region_destroy(mm_region_t *r)
+{
+    mm_heap_t *h = r->heap;
+
+    region_release(h, r->big);
+    region_release(h, r->chunk);
+    mm_heap_free(h, r);
+    h->stats.r_regions--;
+}
+
+/*
+ * mm_heap_pool_create - Make a pool of obj_size byte objects aligned to align
+ *     (a power of two; 0 means the usual 8 bytes)
+ */
+mm_pool_t *mm_heap_pool_create(mm_heap_t *h, size_t obj_size, size_t align)
+{
+    mm_pool_t *p;
+
+    if (align < DSIZE)
+        align = DSIZE;
+    if (obj_size == 0 || (align & (align - 1)))
+        return NULL;
+    if ((p = mm_heap_malloc(h, sizeof(mm_pool_t))) == NULL)
+        return NULL;
+    p->heap = h;
+    p->free = NULL;
+    p->slabs = NULL;
+    p->size = ROUNDUP(MAX(obj_size, sizeof(void *)), align);
+    p->align = align;
+    h->stats.p_pools++;
+    return p;
+}
+
+/*
+ * mm_pool_get - Pop a slot off the free list
+ */
+void *mm_pool_get(mm_pool_t *p)
+{
+    void *obj = p->free;
+
+    if (obj == NULL && (obj = pool_grow(p)) == NULL)
+        return NULL;
+    p->free = SLOT_NEXT(obj);
+    return obj;
+}
+
+/*
+ * mm_pool_put - Push a slot back on the free list
+ */
+void mm_pool_put(mm_pool_t *p, void *obj)
+{
+    SLOT_NEXT(obj) = p->free;
+    p->free = obj;
+}
+
+/*
+ * mm_pool_destroy - Free every slab and the pool itself
+ */
+void mm_pool_destroy(mm_pool_t *p)
+{
+    mm_heap_t *h = p->heap;
+    char *slab, *next;
+
+    for (slab = p->slabs; slab != NULL; slab = next) {
+        next = CHUNK_NEXT(slab);
+        h->stats.p_bytes -= GET_SIZE(HDRP(slab));
+        mm_heap_free(h, slab);
+    }
+    mm_heap_free(h, p);
+    h->stats.p_pools--;
+}
+
+/*
+ * mm_heap_free_remote - Push ptr on the remote free stack with one CAS. Only
+ *     the owner pops, and it takes the whole stack at once, so there is
+ *     no ABA problem.
+ */
+void mm_heap_free_remote(mm_heap_t *h, void *ptr)
+{
+    void *head = __atomic_load_n(&h->remote_head, __ATOMIC_RELAXED);
+
+    do {
+        SLOT_NEXT(ptr) = head;
+    } while (!__atomic_compare_exchange_n(&h->remote_head, &head, ptr, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * mm_heap_mmap_threshold - Set the request size from which blocks are mapped
+ */
+void mm_heap_mmap_threshold(mm_heap_t *h, size_t bytes)
+{
+    h->mmap_threshold = bytes;
+}
+
+/*
+ * mm_heap_cache_mode - Select the front end; call right after mm_init, before
+ *     other threads use the heap. The mode survives later mm_init calls.
+ */
+void mm_heap_cache_mode(mm_heap_t *h, int mode)
+{
+    h->cache_mode = mode;
+}
+
+/*
+ * mm_heap_cache_flush - Return the blocks in the caller's cache to the lists,
+ *     e.g. when a thread exits in MM_CACHE_THREAD mode. A thread's cache
+ *     goes back too; a CPU cache stays for the next thread on that CPU.
+ */
+void mm_heap_cache_flush(mm_heap_t *h)
+{
+    cache_t **cp;
+    cache_t *c;
+    int i;
+
+    if (h->cache_mode == MM_CACHE_OFF || (cp = cache_slot(h, 0)) == NULL ||
+        (c = __atomic_load_n(cp, __ATOMIC_ACQUIRE)) == NULL)
+        return;
+    if (h->cache_mode == MM_CACHE_CPU)
+        spin_lock(&c->lock);
+    for (i = 0; i < CACHE_CLASSES; i++)
+        cache_put_back(h, c, i, c->count[i]);
+    if (h->cache_mode == MM_CACHE_CPU) {
+        spin_unlock(&c->lock);
+        return;
+    }
+
+    spin_lock(&h->core_lock);
+    *cp = NULL;
+    core_free(h, c);
+    spin_unlock(&h->core_lock);
+}
+
+/*
+ * mm_heap_lock_all - Take every heap lock, CPU caches first as cache_malloc
+ *     does. Used around fork so the child never inherits a lock that a
+ *     thread it does not have was holding. A CPU cache created while the
+ *     caches were being locked is only found once core_lock is held; it
+ *     is locked after dropping core_lock again, and the check repeated.
+ *     Caches are only created under core_lock, so this ends.
+ */
+void mm_heap_lock_all(mm_heap_t *h)
+{
+    int i, missed;
+
+    for (i = 0; i < MM_MAXCPU; i++)
+        h->held_cache[i] = NULL;
+    do {
+        for (i = 0; i < MM_MAXCPU; i++) {
+            if (h->cache_mode == MM_CACHE_CPU && h->held_cache[i] == NULL &&
+                h->cpu_cache[i] != NULL) {
+                h->held_cache[i] = h->cpu_cache[i];
+                spin_lock(&h->held_cache[i]->lock);
+            }
+        }
+        spin_lock(&h->core_lock);
+        for (i = 0, missed = 0; i < MM_MAXCPU; i++)
+            if (h->cache_mode == MM_CACHE_CPU && h->held_cache[i] == NULL &&
+                __atomic_load_n(&h->cpu_cache[i], __ATOMIC_ACQUIRE) != NULL)
+                missed = 1;
+        if (missed)
+            spin_unlock(&h->core_lock);
+    } while (missed);
+}
+
+/*
+ * mm_heap_unlock_all - Release what mm_lock_all took, in parent and child
+ */
+void mm_heap_unlock_all(mm_heap_t *h)
+{
+    int i;
+
+    spin_unlock(&h->core_lock);
+    for (i = 0; i < MM_MAXCPU; i++)
+        if (h->held_cache[i] != NULL)
+            spin_unlock(&h->held_cache[i]->lock);
+}
+
+/*
+ * mm_heap_free - Park small blocks in the front end cache when one is on;
+ *     otherwise return the block to the segregated lists.
+ */
+void mm_heap_free(mm_heap_t *h, void *ptr)
+{
+    unsigned int hdr;
+
+    if (h->cache_mode == MM_CACHE_OFF) {
+        core_free(h, ptr);
+        return;
+    }
+
+    /* flagged blocks keep their bookkeeping in core_free */
+    hdr = GET(HDRP(ptr));
+    if (!(hdr & (CLINE_BIT|MOVE_BIT)) && (hdr & SIZE_MASK) != 0 &&
+        (hdr & SIZE_MASK) <= CACHE_MAXBLOCK && cache_free(h, ptr, hdr & SIZE_MASK))
+        return;
+
+    spin_lock(&h->core_lock);
+    core_free(h, ptr);
+    spin_unlock(&h->core_lock);
+}
+
+/*
+ * core_free - Mark the block free and coalesce it into the lists
+ */
+static void core_free(mm_heap_t *h, void *ptr)
 {	
     size_t size = GET_SIZE(HDRP(ptr));
+
+    if (size == 0) {                    /* mapped block */
+        mem_heap_unmap(h->mem, MAP_BASE(ptr), MAP_LEN(ptr));
+        h->stats.m_blocks--;
+        return;
+    }
+
+    if (GET_CLINE(HDRP(ptr))) {
+        h->stats.cl_blocks--;
+        h->stats.cl_bytes -= size;
+    }
 	
     PUT(HDRP(ptr), PACK(size, 0));
     PUT(FTRP(ptr), PACK(size, 0));
     PUT_SUCC(ptr, 0);
     PUT_PRED(ptr, 0);
 
-    coalesce(ptr);
+    coalesce(h, ptr);
 }
 
 /*
  * coalesce - Boundary tag coalescing. Return ptr to coalesced block
  * 			  we must remove succ or pred of next or prev block 
+ *            A neighbour is left alone if merging it would make a block
+ *            bigger than SIZE_MASK, so the class bits never reach the size.
  */
-static void *coalesce(void *bp) 
+static void *coalesce(mm_heap_t *h, void *bp) 
 {
     size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(bp)));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
+    if (!next_alloc && size + GET_SIZE(HDRP(NEXT_BLKP(bp))) > SIZE_MASK)
+        next_alloc = 1;
+    if (!prev_alloc && size + GET_SIZE(HDRP(PREV_BLKP(bp))) +
+        (next_alloc ? 0 : GET_SIZE(HDRP(NEXT_BLKP(bp)))) > SIZE_MASK)
+        prev_alloc = 1;
+
     if (prev_alloc && next_alloc) {            /* alloc-> bp ->alloc */
 		/* then we will insert(bp) */
     }
 
     else if (prev_alloc && !next_alloc) {      /* alloc-> bp ->free */
-        remove_s_p(NEXT_BLKP(bp));
+        if (h->compact_cursor == NEXT_BLKP(bp)) h->compact_cursor = bp;
+        remove_s_p(h, NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         PUT(HDRP(bp), PACK(size, 0));
         PUT(FTRP(bp), PACK(size,0));
     }
 
     else if (!prev_alloc && next_alloc) {      /* free-> bp ->alloc */
-        remove_s_p(PREV_BLKP(bp));
+        if (h->compact_cursor == bp) h->compact_cursor = PREV_BLKP(bp);
+        remove_s_p(h, PREV_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         PUT(FTRP(bp), PACK(size, 0));
         PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
@@ -187,8 +892,10 @@ static void *coalesce(void *bp)
     }
 
     else {                                     /* free-> bp ->free */
-        remove_s_p(NEXT_BLKP(bp));
-        remove_s_p(PREV_BLKP(bp));
+        if (h->compact_cursor == bp || h->compact_cursor == NEXT_BLKP(bp))
+            h->compact_cursor = PREV_BLKP(bp);
+        remove_s_p(h, NEXT_BLKP(bp));
+        remove_s_p(h, PREV_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
             GET_SIZE(FTRP(NEXT_BLKP(bp)));
         PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
@@ -196,7 +903,7 @@ static void *coalesce(void *bp)
         bp = PREV_BLKP(bp);
     }
     
-    insert(bp);
+    insert(h, bp);
     
     return bp;
 }
@@ -205,9 +912,9 @@ static void *coalesce(void *bp)
  * remove_s_p - remove the block from free list
                 by changing pointer of succ and pred.
  */
-static void remove_s_p(void *bp)
+static void remove_s_p(mm_heap_t *h, void *bp)
 {
-    void *root = get_sfreeh(GET_SIZE(HDRP(bp))); 
+    void *root = h->block_list_start + GET_CLASS(HDRP(bp)) * WSIZE;
     void* pred = GET_PRED(bp);
     void* succ = GET_SUCC(bp);
 
@@ -236,18 +943,24 @@ static void remove_s_p(void *bp)
 /*
  * insert - NOT FILO use from small to big
  */
-static void insert(void* bp)
+static void insert(mm_heap_t *h, void* bp)
 {
     if (bp == NULL)
         return;
-    void* root = get_sfreeh(GET_SIZE(HDRP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int class = (size < CLASS_LUT_MAX) ? class_lut[size >> 3] : NCLASSES-1;
+    void* root = h->block_list_start + class * WSIZE;
     void* pred = root;
     void* succ = GET(root);
 
+    /* remember the class for remove_s_p, keep the size copy beside the links */
+    PUT(HDRP(bp), PACK(size, 0) | (class << CLASS_SHIFT));
+    PUT(FSIZEP(bp), PACK(size, 0));
+
     /* size form small to big to aviod always use big free block */
     while (succ != NULL)
     {
-        if (GET_SIZE(HDRP(succ)) >= GET_SIZE(HDRP(bp))) break;
+        if (GET_FSIZE(succ) >= size) break;
         pred = succ;
         succ = GET_SUCC(succ);
     }
@@ -285,12 +998,12 @@ static void insert(void* bp)
  * place - Place block of asize bytes at start of free block bp 
  *         and split if remainder would be at least minimum block size
  */
-static void place(void *bp, size_t asize)
+static void place(mm_heap_t *h, void *bp, size_t asize)
 {
     size_t bsize = GET_SIZE(HDRP(bp));   
     
     /* 'bp' will be an allocted block, so we remove 'bp' from free list*/
-    remove_s_p(bp);
+    remove_s_p(h, bp);
 
     if ((bsize - asize) >= (2*DSIZE)) { 
         PUT(HDRP(bp), PACK(asize, 1));
@@ -302,7 +1015,7 @@ static void place(void *bp, size_t asize)
         PUT(FTRP(bp), PACK(bsize-asize, 0));
         PUT_SUCC(bp, 0);
         PUT_PRED(bp, 0);
-        coalesce(bp);
+        coalesce(h, bp);
     }
     else {
         PUT(HDRP(bp), PACK(bsize, 1));
@@ -310,15 +1023,402 @@ static void place(void *bp, size_t asize)
     }
 }
 
+/*
+ * slide - Move handle block hbp down to start at free block bp, which
+ *     directly precedes it, and repoint its handle. Returns the free
+ *     block that now follows the moved one (after coalescing).
+ */
+static void *slide(mm_heap_t *h, void *bp, void *hbp)
+{
+    size_t fsize = GET_SIZE(HDRP(bp));
+    size_t hsize = GET_SIZE(HDRP(hbp));
+    void **slot;
+
+    remove_s_p(h, bp);
+
+    /* header, payload and footer move as one piece */
+    memmove(HDRP(bp), HDRP(hbp), hsize);
+    slot = (void **)GET(bp);
+    *slot = (char *)bp + DSIZE;
+    h->stats.h_moved += hsize;
+
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(fsize, 0));
+    PUT(FTRP(bp), PACK(fsize, 0));
+    return coalesce(h, bp);
+}
+
+/*
+ * trim - Give a free block at the top of the heap back to memlib
+ */
+static void trim(mm_heap_t *h)
+{
+    char *bp = (char *)mem_heap_last(h->mem) + 1;	/* just past the epilogue */
+    size_t size;
+
+    if (GET_ALLOC(bp - DSIZE))
+        return;
+    bp = PREV_BLKP(bp);
+    size = GET_SIZE(HDRP(bp));
+    remove_s_p(h, bp);
+    if (mem_heap_sbrk(h->mem, -(ptrdiff_t)size) == (void *)-1) {
+        insert(h, bp);
+        return;
+    }
+    PUT(HDRP(bp), PACK(0, 1));               /* New epilogue header */
+    h->stats.h_trimmed += size;
+}
+
+/*
+ * region_chunk - Get a chunk with size usable bytes after its link word
+ */
+static char *region_chunk(mm_heap_t *h, size_t size)
+{
+    char *c;
+
+    if ((c = mm_heap_malloc(h, size + DSIZE)) == NULL)
+        return NULL;
+    h->stats.r_bytes += GET_SIZE(HDRP(c));
+    return c;
+}
+
+/*
+ * region_release - Free a list of region chunks
+ */
+static void region_release(mm_heap_t *h, char *chunk)
+{
+    char *next;
+
+    for (; chunk != NULL; chunk = next) {
+        next = CHUNK_NEXT(chunk);
+        h->stats.r_bytes -= GET_SIZE(HDRP(chunk));
+        mm_heap_free(h, chunk);
+    }
+}
+
+/*
+ * pool_grow - Add a slab to pool p and thread its slots onto the free
+ *     list. Returns the first slot, or NULL if the heap is exhausted.
+ */
+static void *pool_grow(mm_pool_t *p)
+{
+    mm_heap_t *h = p->heap;
+    size_t bytes = MAX(POOL_SLAB, POOL_MINOBJS * p->size + p->align + DSIZE);
+    char *slab, *first, *s;
+    size_t n;
+
+    if ((slab = mm_heap_malloc(h, bytes)) == NULL)
+        return NULL;
+    h->stats.p_bytes += GET_SIZE(HDRP(slab));
+    CHUNK_NEXT(slab) = p->slabs;
+    p->slabs = slab;
+
+    first = (char *)ROUNDUP(slab + DSIZE, p->align);
+    n = (slab + bytes - first) / p->size;
+    for (s = first; --n > 0; s += p->size)
+        SLOT_NEXT(s) = s + p->size;
+    SLOT_NEXT(s) = p->free;
+    p->free = first;
+    return first;
+}
+
+/*
+ * drain_remote - Detach the remote free stack and free it as a batch
+ */
+static void drain_remote(mm_heap_t *h)
+{
+    void *bp = __atomic_exchange_n(&h->remote_head, NULL, __ATOMIC_ACQUIRE);
+    void *next;
+
+    for (; bp != NULL; bp = next) {
+        next = SLOT_NEXT(bp);
+        core_free(h, bp);
+        h->stats.rf_drained++;
+    }
+}
+
+/*
+ * cache_malloc - Pop a block of asize bytes from the caller's cache,
+ *     refilling a batch from the lists when it is empty
+ */
+static void *cache_malloc(mm_heap_t *h, size_t asize)
+{
+    cache_t *c;
+    int idx = CACHE_IDX(asize);
+    void *bp = NULL;
+
+    if ((c = cache_get(h)) == NULL)
+        return NULL;
+    if (h->cache_mode == MM_CACHE_CPU)
+        spin_lock(&c->lock);
+
+    if (c->count[idx] == 0) {
+        spin_lock(&h->core_lock);
+        while (c->count[idx] < CACHE_BATCH &&
+               (bp = core_malloc(h, asize - DSIZE)) != NULL) {
+            c->slot[idx][c->count[idx]++] = bp;
+            __atomic_fetch_add(&h->stats.c_bytes, GET_SIZE(HDRP(bp)), __ATOMIC_RELAXED);
+        }
+        spin_unlock(&h->core_lock);
+    }
+    if (c->count[idx] > 0) {
+        bp = c->slot[idx][--c->count[idx]];
+        __atomic_fetch_sub(&h->stats.c_bytes, GET_SIZE(HDRP(bp)), __ATOMIC_RELAXED);
+    }
+
+    if (h->cache_mode == MM_CACHE_CPU)
+        spin_unlock(&c->lock);
+    return bp;
+}
+
+/*
+ * cache_free - Push ptr on the caller's cache, first moving a batch back
+ *     to the lists if it is full. Returns 0 if there is no cache.
+ */
+static int cache_free(mm_heap_t *h, void *ptr, size_t asize)
+{
+    cache_t *c;
+    int idx = CACHE_IDX(asize);
+
+    if ((c = cache_get(h)) == NULL)
+        return 0;
+    if (h->cache_mode == MM_CACHE_CPU)
+        spin_lock(&c->lock);
+
+    if (c->count[idx] == CACHE_DEPTH)
+        cache_put_back(h, c, idx, CACHE_BATCH);
+    c->slot[idx][c->count[idx]++] = ptr;
+    __atomic_fetch_add(&h->stats.c_bytes, asize, __ATOMIC_RELAXED);
+
+    if (h->cache_mode == MM_CACHE_CPU)
+        spin_unlock(&c->lock);
+    return 1;
+}
+
+/*
+ * cache_put_back - Free the top n blocks of one class of cache c
+ */
+static void cache_put_back(mm_heap_t *h, cache_t *c, int idx, int n)
+{
+    void *bp;
+
+    spin_lock(&h->core_lock);
+    while (n-- > 0) {
+        bp = c->slot[idx][--c->count[idx]];
+        __atomic_fetch_sub(&h->stats.c_bytes, GET_SIZE(HDRP(bp)), __ATOMIC_RELAXED);
+        core_free(h, bp);
+    }
+    spin_unlock(&h->core_lock);
+}
+
+/*
+ * current_cpu - CPU the caller runs on, read from the rseq area the C
+ *     library registered when there is one, else from sched_getcpu
+ */
+static inline int current_cpu(void)
+{
+#ifdef HAVE_RSEQ
+    if (__rseq_size > 0) {
+        struct rseq *rs = (struct rseq *)
+            ((char *)__builtin_thread_pointer() + __rseq_offset);
+        return (int)rs->cpu_id;
+    }
+#endif
+    return sched_getcpu();
+}
+
+/*
+ * cache_slot - Where the pointer to the caller's cache is kept. A thread
+ *     without a slot for this heap gets one only if create is set;
+ *     otherwise the result is NULL.
+ */
+static cache_t **cache_slot(mm_heap_t *h, int create)
+{
+    int cpu, i;
+
+    if (h->cache_mode == MM_CACHE_CPU) {
+        cpu = current_cpu();
+        return &h->cpu_cache[(cpu < 0 ? 0 : cpu) % MM_MAXCPU];
+    }
+
+    for (i = 0; i < TLS_HEAPS && thread_cache[i].gen != h->gen; i++)
+        ;
+    if (i == TLS_HEAPS) {       /* new heap, or it was reset under us */
+        if (!create)
+            return NULL;
+        for (i = 0; i < TLS_HEAPS && thread_cache[i].gen != 0; i++)
+            ;
+        if (i == TLS_HEAPS)
+            i = h->gen % TLS_HEAPS;
+        thread_cache[i].gen = h->gen;
+        thread_cache[i].cache = NULL;
+    }
+    return &thread_cache[i].cache;
+}
+
+/*
+ * cache_get - The cache the caller should use, created on first use.
+ *     The cache itself is an ordinary block from the lists.
+ */
+static cache_t *cache_get(mm_heap_t *h)
+{
+    cache_t **cp = cache_slot(h, 1);
+    cache_t *c;
+
+    if ((c = __atomic_load_n(cp, __ATOMIC_ACQUIRE)) != NULL)
+        return c;
+
+    spin_lock(&h->core_lock);
+    if ((c = *cp) == NULL) {
+        if ((c = core_malloc(h, sizeof(cache_t))) != NULL) {
+            memset(c, 0, sizeof(cache_t));
+            h->stats.c_caches++;
+        }
+        __atomic_store_n(cp, c, __ATOMIC_RELEASE);
+    }
+    spin_unlock(&h->core_lock);
+    return c;
+}
+
+/*
+ * spin_lock - Test and test-and-set lock, yielding while it is busy
+ */
+static void spin_lock(int *lock)
+{
+    int spins = 0;
+
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+            if (++spins % 64 == 0)
+                sched_yield();
+    }
+}
+
+static void spin_unlock(int *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * map_alloc - Give a request a page-aligned mapping of its own
+ */
+static void *map_alloc(mm_heap_t *h, size_t size)
+{
+    size_t len = ROUNDUP(size + DSIZE, mem_pagesize());
+    char *m;
+
+    if (len < size)                     /* size wrapped around */
+        return NULL;
+    if ((m = mem_heap_map(h->mem, len)) == NULL)
+        return NULL;
+    PUT(m, len);
+    PUT(m + WSIZE, PACK(0, 1));
+    h->stats.m_blocks++;
+    return m + DSIZE;
+}
+
+/*
+ * map_alloc_aligned - Like map_alloc, but the payload is aligned to align
+ *     bytes, at most align bytes into the mapping
+ */
+static void *map_alloc_aligned(mm_heap_t *h, size_t size, size_t align)
+{
+    size_t len = ROUNDUP(size + align, mem_pagesize());
+    char *m, *bp;
+
+    if (len < size)
+        return NULL;
+    if ((m = mem_heap_map(h->mem, len)) == NULL)
+        return NULL;
+    bp = (char *)ROUNDUP(m + 3*WSIZE, align);
+    PUT(bp - 3*WSIZE, bp - m);
+    PUT(bp - DSIZE, len | MAP_SHIFTED);
+    PUT(HDRP(bp), PACK(0, 1));
+    h->stats.m_blocks++;
+    return bp;
+}
+
+/*
+ * map_realloc - Resize a mapped block in place or by moving its pages.
+ *     The payload keeps its offset into the mapping.
+ */
+static void *map_realloc(mm_heap_t *h, void *bp, size_t size)
+{
+    size_t off = MAP_OFF(bp);
+    size_t len = ROUNDUP(size + off, mem_pagesize());
+    char *m;
+
+    if (len < size)
+        return NULL;
+    if (len == MAP_LEN(bp))
+        return bp;
+    if ((m = mem_heap_remap(h->mem, MAP_BASE(bp), MAP_LEN(bp), len)) == NULL)
+        return NULL;
+    PUT(m + off - DSIZE, len | (off != DSIZE ? MAP_SHIFTED : 0));
+    h->stats.m_remaps++;
+    return m + off;
+}
+
+/*
+ * payload_size - Usable bytes of an allocated block
+ */
+static size_t payload_size(void *bp)
+{
+    if (MAPPED(bp))
+        return MAP_LEN(bp) - MAP_OFF(bp);
+    return GET_SIZE(HDRP(bp)) - DSIZE;
+}
+
+/*
+ * alloc_aligned - Allocate a block of asize bytes whose payload is
+ *     aligned to align bytes. The space in front of the aligned payload
+ *     goes back to the free lists as its own block.
+ */
+static void *alloc_aligned(mm_heap_t *h, size_t asize, size_t align)
+{
+    size_t need = asize + align + 2*DSIZE;	/* worst case front gap */
+    size_t bsize, gap, extendsize;
+    char *bp, *abp;
+
+    if ((bp = find_fit(h, need)) == NULL) {
+        extendsize = MAX(need, CHUNKSIZE);
+        if ((bp = extend_heap(h, extendsize/WSIZE)) == NULL)
+            return NULL;
+    }
+
+    /* gap in front must be empty or hold a minimum free block */
+    abp = (char *)ROUNDUP(bp, align);
+    while ((gap = abp - bp) != 0 && gap < 2*DSIZE)
+        abp += align;
+
+    if (gap) {
+        bsize = GET_SIZE(HDRP(bp));
+        remove_s_p(h, bp);
+
+        /* front gap: its prev is allocated, so no need to coalesce */
+        PUT(HDRP(bp), PACK(gap, 0));
+        PUT(FTRP(bp), PACK(gap, 0));
+        insert(h, bp);
+
+        bp = abp;
+        PUT(HDRP(bp), PACK(bsize-gap, 0));
+        PUT(FTRP(bp), PACK(bsize-gap, 0));
+        insert(h, bp);
+    }
+
+    place(h, bp, asize);
+    return bp;
+}
+
 /* 
  * find_fit - Find a fit for a block with asize bytes 
  */
-static void* find_fit(size_t asize)
+static void* find_fit(mm_heap_t *h, size_t asize)
 {
-    for (void* root = get_sfreeh(asize); root != (heap_listp-WSIZE); root += WSIZE){
+    for (void* root = get_sfreeh(h, asize); root != (h->heap_listp-WSIZE); root += WSIZE){
         void* bp = GET(root);
         while (bp){
-            if (GET_SIZE(HDRP(bp)) >= asize) return bp;
+            if (GET_FSIZE(bp) >= asize) return bp;
             bp = GET_SUCC(bp);
         }
     }
@@ -327,40 +1427,40 @@ static void* find_fit(size_t asize)
 
 
 /* 
- * find_num - find the head block of seglist
+ * find_num - find the head block of seglist, one table lookup
+ *            (mm_class.h is generated by mkclass)
  */
-void* get_sfreeh(size_t size)
+void* get_sfreeh(mm_heap_t *h, size_t size)
 {	
-	int i = 0;
-	
-	/* i > 4096 */
-	if(size >= 4096)
-		return block_list_start + (8 * WSIZE);
-	
-	/* i <= 32 */
-	size = size >> 5;
-	
-	/* other */
-	while (size){
-		size = size >> 1;
-		i++;
-	}
-	
-    return block_list_start + (i * WSIZE);
+	if(size >= CLASS_LUT_MAX)
+		return h->block_list_start + ((NCLASSES-1) * WSIZE);
+    return h->block_list_start + (class_lut[size >> 3] * WSIZE);
 }
 
 /* 
  * extend_heap - Extend heap with free block and return its block pointer
+ *     A segment grows in place only up to SIZE_MASK bytes, the largest
+ *     block a header holds; past that the heap goes on in a new segment.
  */
-static void *extend_heap(size_t words) 
+static void *extend_heap(mm_heap_t *h, size_t words) 
 {
     char *bp;
     size_t size;
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
-    if ((long)(bp = mem_sbrk(size)) == -1)  
-        return NULL;                                        
+    if ((char *)mem_heap_last(h->mem) + 1 + size - h->seg_lo > SIZE_MASK ||
+        (long)(bp = mem_heap_sbrk(h->mem, size)) == -1) {
+        /* No room to grow in place: new segment, fenced by its own 
+           prologue and epilogue so coalescing never crosses the gap */
+        if ((bp = mem_heap_segment(h->mem, size + 4*WSIZE)) == NULL)
+            return NULL;
+        h->seg_lo = bp;
+        PUT(bp, 0);                             /* Alignment padding */
+        PUT(bp + (1*WSIZE), PACK(DSIZE, 1));    /* Prologue header */
+        PUT(bp + (2*WSIZE), PACK(DSIZE, 1));    /* Prologue footer */
+        bp += 4*WSIZE;
+    }
 	
     /* Initialize free block header/footer and the epilogue header */
     PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
@@ -371,31 +1471,41 @@ static void *extend_heap(size_t words)
 	PUT_SUCC(bp, 0);			/* Free block succ */          
 	PUT_PRED(bp, 0);	  		/* Free block pred */
 			
-	return coalesce(bp);
+	return coalesce(h, bp);
 }
 
 /*
- * mm_realloc - Naive implementation of realloc
+ * mm_heap_realloc - Naive implementation of realloc
  */
-void *mm_realloc(void *ptr, size_t newsize)
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t newsize)
 {
     size_t oldsize;
     void *newptr;
 
     /* If size == 0 then this is just free, and we return NULL. */
     if(newsize == 0) {
-        mm_free(ptr);
+        mm_heap_free(h, ptr);
         return 0;
     }
 
     /* If oldptr is NULL, then this is just malloc. */
     if(ptr == NULL) {
-        return mm_malloc(newsize);
+        return mm_heap_malloc(h, newsize);
+    }
+
+    /* Mapped blocks that stay huge move their pages, not their bytes */
+    if (MAPPED(ptr) && newsize >= h->mmap_threshold) {
+        if (h->cache_mode != MM_CACHE_OFF)
+            spin_lock(&h->core_lock);
+        newptr = map_realloc(h, ptr, newsize);
+        if (h->cache_mode != MM_CACHE_OFF)
+            spin_unlock(&h->core_lock);
+        return newptr;
     }
 	
 	/* begain change the size of block that be pointered by ptr */
 	/* mm_malloc() fails equals realloc() fails */
-    newptr = mm_malloc(newsize);
+    newptr = mm_heap_malloc(h, newsize);
 
     /* If realloc() fails the original block is left untouched  */
     if(!newptr) {
@@ -410,20 +1520,103 @@ void *mm_realloc(void *ptr, size_t newsize)
     but old data equal or smaller than new data, 
     size of oldblock not change 
     */
-    oldsize = GET_SIZE(HDRP(ptr));
+    oldsize = payload_size(ptr);
     if(newsize < oldsize) 
     	oldsize = newsize;
     memcpy(newptr, ptr, oldsize);
 
     /* Free the old block. */
-    mm_free(ptr);
+    mm_heap_free(h, ptr);
 
     return newptr;
 }
 
+/*********************************************************
+ * The default heap: the mm_* interface without a heap
+ * argument, as the driver uses it
+ ********************************************************/
 
+void *mm_malloc(size_t size)
+{
+    return mm_heap_malloc(&dflt_heap, size);
+}
 
+void mm_free(void *ptr)
+{
+    mm_heap_free(&dflt_heap, ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    return mm_heap_realloc(&dflt_heap, ptr, size);
+}
+
+void *mm_memalign(size_t align, size_t size)
+{
+    return mm_heap_memalign(&dflt_heap, align, size);
+}
 
+void *mm_malloc_cacheline(size_t size)
+{
+    return mm_heap_malloc_cacheline(&dflt_heap, size);
+}
 
+void mm_stats(mm_stats_t *st)
+{
+    mm_heap_stats(&dflt_heap, st);
+}
 
+mm_handle_t mm_halloc(size_t size)
+{
+    return mm_heap_halloc(&dflt_heap, size);
+}
 
+void mm_hfree(mm_handle_t handle)
+{
+    mm_heap_hfree(&dflt_heap, handle);
+}
+
+int mm_hcompact(size_t budget)
+{
+    return mm_heap_hcompact(&dflt_heap, budget);
+}
+
+mm_region_t *mm_region_create(void)
+{
+    return mm_heap_region_create(&dflt_heap);
+}
+
+mm_pool_t *mm_pool_create(size_t obj_size, size_t align)
+{
+    return mm_heap_pool_create(&dflt_heap, obj_size, align);
+}
+
+void mm_free_remote(void *ptr)
+{
+    mm_heap_free_remote(&dflt_heap, ptr);
+}
+
+void mm_mmap_threshold(size_t bytes)
+{
+    mm_heap_mmap_threshold(&dflt_heap, bytes);
+}
+
+void mm_cache_mode(int mode)
+{
+    mm_heap_cache_mode(&dflt_heap, mode);
+}
+
+void mm_cache_flush(void)
+{
+    mm_heap_cache_flush(&dflt_heap);
+}
+
+void mm_lock_all(void)
+{
+    mm_heap_lock_all(&dflt_heap);
+}
+
+void mm_unlock_all(void)
+{
+    mm_heap_unlock_all(&dflt_heap);
+}
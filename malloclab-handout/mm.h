@@ -1,10 +1,129 @@
 #include <stdio.h>
 
+struct mem_heap;
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/* 
+ * Small-object front end. In a cache mode mm_malloc, mm_free and
+ * mm_realloc are thread safe: small blocks are recycled through a cache
+ * per thread or per CPU and everything else takes a lock around the
+ * segregated lists. mm_memalign, mm_malloc_cacheline and mm_hcompact
+ * take that lock too; the other entry points stay single threaded.
+ */
+#define MM_CACHE_OFF    0
+#define MM_CACHE_THREAD 1
+#define MM_CACHE_CPU    2
+extern void mm_cache_mode(int mode);
+extern void mm_cache_flush(void);
+
+/* 
+ * Requests of at least this many bytes get a mapping of their own, which
+ * mm_realloc grows with mremap instead of copying. 0 (default) turns it off.
+ */
+extern void mm_mmap_threshold(size_t bytes);
+
+/* 
+ * Free from a thread that does not own the heap. The block is pushed on
+ * a lock-free stack and the owner frees it on its next mm_malloc.
+ */
+extern void mm_free_remote(void *ptr);
+
+/* 
+ * Aligned blocks, usable size, and locking around fork. Together with
+ * the above these are what mmpreload.c needs to stand in for malloc.
+ */
+extern void *mm_memalign(size_t align, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern int mm_mapped(void *ptr);
+extern void mm_lock_all(void);
+extern void mm_unlock_all(void);
+
+/* Payload starts on a cache line and shares no line with other payloads */
+#define MM_CACHELINE 64
+extern void *mm_malloc_cacheline(size_t size);
+
+/* 
+ * Movable allocations. A handle names a block that the compactor may
+ * slide toward the heap start; re-read mm_hderef() after mm_hcompact().
+ */
+typedef void **mm_handle_t;
+extern mm_handle_t mm_halloc(size_t size);
+extern void *mm_hderef(mm_handle_t handle);
+extern void mm_hfree(mm_handle_t handle);
+extern int mm_hcompact(size_t budget);
+
+/* 
+ * Regions. Allocations bump a pointer through chunks taken from
+ * mm_malloc and are released together by mm_region_reset/destroy.
+ */
+typedef struct mm_region mm_region_t;
+extern mm_region_t *mm_region_create(void);
+extern void *mm_region_alloc(mm_region_t *r, size_t size);
+extern void mm_region_reset(mm_region_t *r);
+extern void mm_region_destroy(mm_region_t *r);
+
+/* 
+ * Pools of fixed size objects. Slots are cut from big mm_malloc blocks
+ * and recycled through a free list threaded through the slots.
+ */
+typedef struct mm_pool mm_pool_t;
+extern mm_pool_t *mm_pool_create(size_t obj_size, size_t align);
+extern void *mm_pool_get(mm_pool_t *p);
+extern void mm_pool_put(mm_pool_t *p, void *obj);
+extern void mm_pool_destroy(mm_pool_t *p);
+
+/* Allocator statistics, filled in by mm_stats() */
+typedef struct {
+    size_t cl_blocks;    /* live cache-line aligned blocks */
+    size_t cl_bytes;     /* heap bytes held by those blocks */
+    size_t cl_overhead;  /* bytes they use beyond an mm_malloc block */
+    size_t h_blocks;     /* live handle blocks */
+    size_t h_moved;      /* bytes slid by the compactor */
+    size_t h_trimmed;    /* bytes given back to memlib after compaction */
+    size_t r_regions;    /* live regions */
+    size_t r_bytes;      /* heap bytes held in region chunks */
+    size_t p_pools;      /* live pools */
+    size_t p_bytes;      /* heap bytes held in pool slabs */
+    size_t rf_drained;   /* remote frees reclaimed by the owner */
+    size_t c_caches;     /* thread or CPU caches created */
+    size_t c_bytes;      /* block bytes parked in those caches */
+    size_t m_blocks;     /* live mapped blocks */
+    size_t m_remaps;     /* reallocs done by remapping */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/* 
+ * Heap instances. An mm_heap_t runs on a memlib heap of its own with
+ * its own lists, caches and statistics, so several can be used side by
+ * side. The calls above work on a default heap over memlib's default
+ * heap; each has an mm_heap_* counterpart here. Regions and pools stay
+ * with the heap they were created on.
+ */
+typedef struct mm_heap mm_heap_t;
+extern mm_heap_t *mm_heap_init(struct mem_heap *mem);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+extern void *mm_heap_memalign(mm_heap_t *h, size_t align, size_t size);
+extern void *mm_heap_malloc_cacheline(mm_heap_t *h, size_t size);
+extern void mm_heap_stats(mm_heap_t *h, mm_stats_t *stats);
+extern mm_handle_t mm_heap_halloc(mm_heap_t *h, size_t size);
+extern void mm_heap_hfree(mm_heap_t *h, mm_handle_t handle);
+extern int mm_heap_hcompact(mm_heap_t *h, size_t budget);
+extern mm_region_t *mm_heap_region_create(mm_heap_t *h);
+extern mm_pool_t *mm_heap_pool_create(mm_heap_t *h, size_t obj_size, size_t align);
+extern void mm_heap_free_remote(mm_heap_t *h, void *ptr);
+extern void mm_heap_mmap_threshold(mm_heap_t *h, size_t bytes);
+extern void mm_heap_cache_mode(mm_heap_t *h, int mode);
+extern void mm_heap_cache_flush(mm_heap_t *h);
+extern void mm_heap_lock_all(mm_heap_t *h);
+extern void mm_heap_unlock_all(mm_heap_t *h);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
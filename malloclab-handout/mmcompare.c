@@ -0,0 +1,396 @@
+/*
+ * mmcompare.c - Compare two allocator builds or variants on the same traces
+ *
+ * A and B are mdriver command lines: two builds of mm.c, or one build
+ * with different options. For example
+ *
+ *     cp mdriver mdriver.old; (edit mm.c); make
+ *     ./mmcompare ./mdriver.old ./mdriver traces/amptjp-bal.rep traces/cccp-bal.rep
+ *     ./mmcompare ./mdriver "./mdriver -M 65536" traces/realloc-bal.rep
+ *
+ * Each trace is run by A and by B in turn, ABBA..., so drift in the
+ * machine's speed falls on both, until the confidence interval of the
+ * speedup is narrow enough or the run limit is reached. The speedup is
+ * the ratio of the median times, A over B, so above 1 means B is
+ * faster; its interval comes from resampling the runs (bootstrap). B
+ * is only called faster or slower when the interval leaves out 1 and
+ * the change is at least the smallest one worth reporting. With no
+ * traces given, mdriver's default set is run as a whole each time.
+ *
+ * usage: mmcompare [-v] [-n min] [-N max] [-e pct] [-c pct] [-m pct]
+ *                  [-B resamples] A B [trace...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define MAXLINE   4096
+#define MAXTRACES 64
+
+/* What is known about one trace */
+typedef struct {
+    char name[MAXLINE];
+    double *secs[2];     /* run times under A and B */
+    double util[2];      /* utilization under A and B */
+    int runs;            /* runs of each */
+    int done;            /* interval narrow enough */
+    double speedup, lo, hi;
+    double *boot;        /* resampled speedups, for the geometric mean */
+} result_t;
+
+static char *cmd[2];
+static int verbose = 0;
+static int min_runs = 5, max_runs = 30;
+static double target = 1.0;   /* interval half-width, % of the speedup */
+static double conf = 95.0;    /* confidence level, % */
+static double min_change = 1.0;
+static int resamples = 2000;
+
+static result_t results[MAXTRACES];
+static int num_results = 0;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: mmcompare [-v] [-n min] [-N max] [-e pct] [-c pct] "
+            "[-m pct]\n"
+            "                 [-B resamples] A B [trace...]\n"
+            "  A, B   mdriver command lines to compare\n"
+            "  -n     runs of each before checking the interval (default 5)\n"
+            "  -N     most runs of each (default 30)\n"
+            "  -e     stop at an interval half-width of pct%% (default 1)\n"
+            "  -c     confidence level in %% (default 95)\n"
+            "  -m     smallest change in %% called a win or loss (default 1)\n"
+            "  -B     bootstrap resamples (default 2000)\n"
+            "  -v     print every run\n");
+    exit(1);
+}
+
+/*********************************************************
+ * Statistics
+ ********************************************************/
+
+static unsigned long long rng = 0x2545F4914F6CDD1Dull;
+
+/* rnd - Uniform in [0, n), from a fixed seed so reruns agree */
+static int rnd(int n)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (int)((rng * 0x2545F4914F6CDD1Dull >> 33) % n);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *v, int n, double *tmp)
+{
+    memcpy(tmp, v, n * sizeof(double));
+    qsort(tmp, n, sizeof(double), cmp_double);
+    return (n % 2) ? tmp[n/2] : (tmp[n/2 - 1] + tmp[n/2]) / 2;
+}
+
+/*
+ * bootstrap - Estimate r's speedup and its confidence interval by
+ *     resampling each side's runs with replacement. The resampled
+ *     speedups are kept in r->boot.
+ */
+static void bootstrap(result_t *r)
+{
+    double *a, *b, *tmp, *sorted;
+    double alpha = 1 - conf / 100;
+    int n = r->runs, i, j;
+
+    a = malloc(n * sizeof(double));
+    b = malloc(n * sizeof(double));
+    tmp = malloc(n * sizeof(double));
+    sorted = malloc(resamples * sizeof(double));
+    if (r->boot == NULL)
+        r->boot = malloc(resamples * sizeof(double));
+    if (!a || !b || !tmp || !sorted || !r->boot) {
+        fprintf(stderr, "mmcompare: out of memory\n");
+        exit(1);
+    }
+
+    r->speedup = median(r->secs[0], n, tmp) / median(r->secs[1], n, tmp);
+    for (i = 0; i < resamples; i++) {
+        for (j = 0; j < n; j++) {
+            a[j] = r->secs[0][rnd(n)];
+            b[j] = r->secs[1][rnd(n)];
+        }
+        r->boot[i] = median(a, n, tmp) / median(b, n, tmp);
+    }
+    memcpy(sorted, r->boot, resamples * sizeof(double));
+    qsort(sorted, resamples, sizeof(double), cmp_double);
+    r->lo = sorted[(int)(alpha / 2 * resamples)];
+    r->hi = sorted[(int)ceil((1 - alpha / 2) * resamples) - 1];
+
+    free(a);
+    free(b);
+    free(tmp);
+    free(sorted);
+}
+
+/* verdict - What the interval [lo, hi] around speedup says about B */
+static const char *verdict(double speedup, double lo, double hi)
+{
+    if (fabs(speedup - 1) * 100 < min_change)
+        return "same";
+    if (lo > 1)
+        return "faster";
+    if (hi < 1)
+        return "slower";
+    return "same (noise)";
+}
+
+/*********************************************************
+ * Running mdriver
+ ********************************************************/
+
+/*
+ * csv_field - Copy the next field of a CSV line into out; returns a
+ *     pointer past it, or NULL at the end of the line
+ */
+static char *csv_field(char *s, char *out)
+{
+    if (s == NULL || *s == '\0' || *s == '\n')
+        return NULL;
+    if (*s == '"') {
+        for (s++; *s != '\0'; s++) {
+            if (*s == '"') {
+                if (s[1] != '"')
+                    break;
+                s++;
+            }
+            *out++ = *s;
+        }
+        if (*s == '"')
+            s++;
+    }
+    else
+        while (*s != ',' && *s != '\n' && *s != '\0')
+            *out++ = *s++;
+    *out = '\0';
+    return (*s == ',') ? s + 1 : s;
+}
+
+static result_t *find_result(const char *name)
+{
+    result_t *r;
+    int i;
+
+    for (i = 0; i < num_results; i++)
+        if (!strcmp(results[i].name, name))
+            return &results[i];
+    if (num_results == MAXTRACES) {
+        fprintf(stderr, "mmcompare: more than %d traces\n", MAXTRACES);
+        exit(1);
+    }
+    r = &results[num_results++];
+    strcpy(r->name, name);
+    if ((r->secs[0] = malloc(max_runs * sizeof(double))) == NULL ||
+        (r->secs[1] = malloc(max_runs * sizeof(double))) == NULL) {
+        fprintf(stderr, "mmcompare: out of memory\n");
+        exit(1);
+    }
+    return r;
+}
+
+/*
+ * run - Run variant v (0 for A, 1 for B) on trace, or on the default
+ *     traces if trace is NULL, and add each trace's time to its results
+ */
+static void run(int v, const char *trace, int round)
+{
+    char command[2 * MAXLINE], line[MAXLINE], field[MAXLINE];
+    int col, alloc_col = -1, file_col = -1, valid_col = -1, secs_col = -1;
+    int util_col = -1, rows = 0, ok;
+    char alloc[MAXLINE], file[MAXLINE];
+    double secs = 0, util = 0;
+    result_t *r;
+    FILE *fp;
+    char *s;
+
+    if (trace != NULL)
+        snprintf(command, sizeof(command), "%s -a -f '%s' --format=csv "
+                 "2>/dev/null", cmd[v], trace);
+    else
+        snprintf(command, sizeof(command), "%s -a --format=csv 2>/dev/null",
+                 cmd[v]);
+    if ((fp = popen(command, "r")) == NULL) {
+        fprintf(stderr, "mmcompare: could not run %s\n", cmd[v]);
+        exit(1);
+    }
+
+    /* The header says which column is which */
+    if (fgets(line, MAXLINE, fp) != NULL)
+        for (s = line, col = 0; (s = csv_field(s, field)) != NULL; col++) {
+            if (!strcmp(field, "alloc"))      alloc_col = col;
+            else if (!strcmp(field, "file"))  file_col = col;
+            else if (!strcmp(field, "valid")) valid_col = col;
+            else if (!strcmp(field, "secs"))  secs_col = col;
+            else if (!strcmp(field, "util"))  util_col = col;
+        }
+    if (alloc_col < 0 || file_col < 0 || valid_col < 0 || secs_col < 0) {
+        fprintf(stderr, "mmcompare: no results from \"%s\"; does it take "
+                "--format=csv?\n", command);
+        exit(1);
+    }
+
+    while (fgets(line, MAXLINE, fp) != NULL) {
+        ok = 1;
+        alloc[0] = file[0] = '\0';
+        for (s = line, col = 0; (s = csv_field(s, field)) != NULL; col++) {
+            if (col == alloc_col)
+                strcpy(alloc, field);
+            else if (col == file_col)
+                strcpy(file, field);
+            else if (col == valid_col)
+                ok = (atoi(field) == 1);
+            else if (col == secs_col)
+                secs = atof(field);
+            else if (col == util_col)
+                util = atof(field);
+        }
+        if (strcmp(alloc, "mm") != 0 || file[0] == '\0')
+            continue;   /* the total row */
+        if (!ok) {
+            fprintf(stderr, "mmcompare: \"%s\" failed on %s\n", cmd[v], file);
+            exit(1);
+        }
+        r = find_result(trace != NULL ? trace : file);
+        if (r->done || r->runs >= max_runs)
+            continue;
+        r->secs[v][r->runs] = secs;
+        r->util[v] = util;
+        if (verbose)
+            printf("round %2d  %c  %-24s %.6f\n", round + 1, 'A' + v,
+                   r->name, secs);
+        rows++;
+    }
+    if (pclose(fp) != 0 || rows == 0) {
+        fprintf(stderr, "mmcompare: \"%s\" failed\n", command);
+        exit(1);
+    }
+}
+
+/*
+ * measure - Run A and B on a trace (or the default set) round after
+ *     round until every trace's interval is narrow enough
+ */
+static void measure(const char *trace)
+{
+    int round, first = num_results, i, open;
+    result_t *r;
+
+    for (round = 0; round < max_runs; round++) {
+        run(round % 2, trace, round);
+        run(1 - round % 2, trace, round);
+        for (i = first; i < num_results; i++)
+            if (!results[i].done)
+                results[i].runs++;
+        if (round + 1 < min_runs)
+            continue;
+        for (i = first, open = 0; i < num_results; i++) {
+            r = &results[i];
+            if (r->done)
+                continue;
+            bootstrap(r);
+            if ((r->hi - r->lo) / 2 <= target / 100 * r->speedup)
+                r->done = 1;
+            else
+                open++;
+        }
+        if (open == 0)
+            break;
+    }
+    for (i = first; i < num_results; i++)
+        if (!results[i].done)
+            bootstrap(&results[i]);
+}
+
+int main(int argc, char **argv)
+{
+    double *geo, *tmp, lo, hi, alpha, sum;
+    result_t *r;
+    int c, i, j, w = 24;
+
+    while ((c = getopt(argc, argv, "vn:N:e:c:m:B:")) != EOF) {
+        switch (c) {
+        case 'v': verbose = 1;                  break;
+        case 'n': min_runs = atoi(optarg);      break;
+        case 'N': max_runs = atoi(optarg);      break;
+        case 'e': target = atof(optarg);        break;
+        case 'c': conf = atof(optarg);          break;
+        case 'm': min_change = atof(optarg);    break;
+        case 'B': resamples = atoi(optarg);     break;
+        default:  usage();
+        }
+    }
+    if (argc - optind < 2 || min_runs < 2 || max_runs < min_runs ||
+        conf <= 0 || conf >= 100 || resamples < 100)
+        usage();
+    cmd[0] = argv[optind];
+    cmd[1] = argv[optind + 1];
+
+    printf("A: %s\nB: %s\n", cmd[0], cmd[1]);
+    printf("speedup = median time under A / median time under B; "
+           "above 1, B is faster\n\n");
+    fflush(stdout);
+    if (optind + 2 == argc)
+        measure(NULL);
+    for (i = optind + 2; i < argc; i++)
+        measure(argv[i]);
+
+    for (i = 0; i < num_results; i++)
+        if ((int)strlen(results[i].name) + 1 > w)
+            w = strlen(results[i].name) + 1;
+    printf("%-*s%5s%11s%11s%9s  %-18s%7s%7s  %s\n", w, "trace", "runs",
+           "A secs", "B secs", "speedup", "interval", "A util", "B util",
+           "verdict");
+    if ((tmp = malloc(max_runs * sizeof(double))) == NULL) {
+        fprintf(stderr, "mmcompare: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < num_results; i++) {
+        r = &results[i];
+        printf("%-*s%5d%11.6f%11.6f%9.3f  [%.3f, %.3f]%*s%6.1f%%%6.1f%%  %s\n",
+               w, r->name, r->runs, median(r->secs[0], r->runs, tmp),
+               median(r->secs[1], r->runs, tmp), r->speedup, r->lo, r->hi,
+               4, "", r->util[0] * 100, r->util[1] * 100,
+               verdict(r->speedup, r->lo, r->hi));
+    }
+    free(tmp);
+
+    /* The geometric mean over traces, with its own interval */
+    if (num_results > 1) {
+        if ((geo = malloc(resamples * sizeof(double))) == NULL) {
+            fprintf(stderr, "mmcompare: out of memory\n");
+            exit(1);
+        }
+        for (j = 0; j < resamples; j++) {
+            for (i = 0, sum = 0; i < num_results; i++)
+                sum += log(results[i].boot[j]);
+            geo[j] = exp(sum / num_results);
+        }
+        for (i = 0, sum = 0; i < num_results; i++)
+            sum += log(results[i].speedup);
+        qsort(geo, resamples, sizeof(double), cmp_double);
+        alpha = 1 - conf / 100;
+        lo = geo[(int)(alpha / 2 * resamples)];
+        hi = geo[(int)ceil((1 - alpha / 2) * resamples) - 1];
+        printf("%-*s%5s%11s%11s%9.3f  [%.3f, %.3f]%*s%14s  %s\n",
+               w, "geometric mean", "", "", "", exp(sum / num_results), lo, hi,
+               4, "", "", verdict(exp(sum / num_results), lo, hi));
+        free(geo);
+    }
+    printf("\n%.0f%% intervals; changes under %.1f%% are reported as the "
+           "same\n", conf, min_change);
+    exit(0);
+}
@@ -0,0 +1,260 @@
+/*
+ * mmpreload.c - Export mm.c as the process allocator
+ *
+ * Built into libmm.so, which stands in for the C library's malloc in
+ * any dynamically linked program:
+ *
+ *     LD_PRELOAD=./libmm.so /usr/bin/time -v cc -c big.c
+ *
+ * The heap is set up by the first call. mm.c runs with a front end
+ * cache so threads do not serialize on small blocks, big requests get
+ * mappings of their own, and a fork handler holds every heap lock
+ * across fork. Settings come from the environment:
+ *
+ *     MM_HEAP_MB   most heap to hand out, in MB (default 2048)
+ *     MM_MMAP_MIN  map requests of at least this many bytes (default 128K)
+ *     MM_CACHE     front end: off, thread or cpu (default cpu)
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <malloc.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define DEF_HEAP_MB   2048
+#define DEF_MMAP_MIN  (128 * 1024)
+
+/* In mm_cache_mode off all calls also take this lock */
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static int ready = 0;
+static int cache_mode = MM_CACHE_CPU;
+
+/* In mm_cache_mode thread, a thread's cache is flushed when it exits */
+static pthread_key_t exit_key;
+static int exit_key_ok = 0;
+static __thread int exit_armed = 0;
+
+/*
+ * env_size - Numeric environment setting, or def if it is not set
+ */
+static size_t env_size(const char *name, size_t def)
+{
+    char *s = getenv(name);
+
+    return (s != NULL && *s != '\0') ? strtoul(s, NULL, 0) : def;
+}
+
+/*
+ * heap_setup - Reserve the heap and start mm. Runs once; nothing in
+ *     here may call malloc.
+ */
+static void heap_setup(void)
+{
+    char *mode = getenv("MM_CACHE");
+
+    if (mode != NULL && !strcmp(mode, "off"))
+        cache_mode = MM_CACHE_OFF;
+    else if (mode != NULL && !strcmp(mode, "thread"))
+        cache_mode = MM_CACHE_THREAD;
+
+    mem_init_size((size_t)env_size("MM_HEAP_MB", DEF_HEAP_MB) << 20);
+    if (mm_init() < 0)
+        abort();
+    mm_mmap_threshold(env_size("MM_MMAP_MIN", DEF_MMAP_MIN));
+    mm_cache_mode(cache_mode);
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+}
+
+static inline void heap_ready(void)
+{
+    if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+        pthread_once(&once, heap_setup);
+}
+
+static inline void lock(void)
+{
+    if (cache_mode == MM_CACHE_OFF)
+        pthread_mutex_lock(&big_lock);
+}
+
+static inline void unlock(void)
+{
+    if (cache_mode == MM_CACHE_OFF)
+        pthread_mutex_unlock(&big_lock);
+}
+
+/*
+ * cache_exit - Key destructor: give the exiting thread's cache back.
+ *     Disarming first lets a later destructor's malloc arm it again.
+ */
+static void cache_exit(void *arg)
+{
+    exit_armed = 0;
+    mm_cache_flush();
+}
+
+/*
+ * cache_arm - Give the key a value in this thread, once, so cache_exit
+ *     runs when it exits
+ */
+static inline void cache_arm(void)
+{
+    if (cache_mode == MM_CACHE_THREAD && !exit_armed && exit_key_ok) {
+        exit_armed = 1;
+        pthread_setspecific(exit_key, &exit_armed);
+    }
+}
+
+/*
+ * Fork handlers: the child gets a copy of the heap with every lock
+ * free, whatever the parent's other threads were doing
+ */
+static void fork_prepare(void)
+{
+    lock();
+    mm_lock_all();
+}
+
+static void fork_release(void)
+{
+    mm_unlock_all();
+    unlock();
+}
+
+/*
+ * preload_init - Register the fork handlers, and the thread exit key in
+ *     thread mode, once the library is loaded. pthread_atfork may itself
+ *     call malloc, so it cannot go in heap_setup.
+ */
+__attribute__((constructor))
+static void preload_init(void)
+{
+    heap_ready();
+    pthread_atfork(fork_prepare, fork_release, fork_release);
+    if (cache_mode == MM_CACHE_THREAD &&
+        pthread_key_create(&exit_key, cache_exit) == 0)
+        __atomic_store_n(&exit_key_ok, 1, __ATOMIC_RELEASE);
+}
+
+/*********************************************************
+ * The C library allocation interface
+ ********************************************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    heap_ready();
+    cache_arm();
+    lock();
+    p = mm_malloc(size ? size : 1);  /* malloc(0) is a unique pointer */
+    unlock();
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    cache_arm();
+    lock();
+    mm_free(ptr);
+    unlock();
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+        return malloc(size);
+    cache_arm();
+    lock();
+    p = mm_realloc(ptr, size);
+    unlock();
+    if (p == NULL && size != 0)
+        errno = ENOMEM;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    void *p;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if ((p = malloc(bytes)) != NULL && !mm_mapped(p))   /* fresh pages are zero */
+        memset(p, 0, bytes);
+    return p;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    size_t bytes;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, bytes);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    heap_ready();
+    lock();
+    p = mm_memalign(align, size ? size : 1);
+    unlock();
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return mm_usable_size(ptr);
+}
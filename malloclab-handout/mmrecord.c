@@ -0,0 +1,629 @@
+/*
+ * mmrecord.c - Record the allocations of a running program as a trace
+ *
+ * Built into libmmrecord.so, which sits in front of the C library's
+ * malloc in any dynamically linked program and writes each request to
+ * a trace that mdriver can replay:
+ *
+ *     MMREC_OUT=cc.rep LD_PRELOAD=./libmmrecord.so cc -c big.c
+ *     ./mdriver -f cc.rep
+ *
+ * Blocks get ids in the order they are allocated, so the trace loads
+ * as it is; blocks still live when the program exits are freed at the
+ * end of the trace, as in the -bal traces. Frees of pointers the
+ * recorder never saw allocated (say, from before it was loaded) are
+ * left out and counted. memalign and friends are recorded as plain
+ * allocations of the same size. Settings come from the environment:
+ *
+ *     MMREC_OUT      trace file, %p becomes the pid (default mmrecord.%p.rep)
+ *     MMREC_THREADS  1: one trace per thread, in MMREC_OUT.<n>
+ *     MMREC_BINARY   1: varint coded binary trace (see tracefmt.h)
+ *
+ * A block freed by a thread other than the one that allocated it goes
+ * in its allocating thread's trace, so each trace replays on its own.
+ * The recorder never calls malloc itself: its tables and buffers are
+ * mapped, and allocations made while resolving the real functions come
+ * from a static buffer.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "tracefmt.h"
+
+#define MAX_STREAMS  256         /* per-thread traces; later threads share */
+#define BUF_BYTES    (1 << 20)   /* write buffer of each trace */
+#define BOOT_BYTES   (64 * 1024) /* for allocations while resolving */
+#define HDR_WIDTH    20          /* digits in each text header line */
+#define MAXLINE      1024
+
+/* A trace being written */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    uint64_t num_ids;      /* ids handed out, also the next id */
+    uint64_t num_ops;
+    uint64_t live_bytes, peak_bytes;
+} stream_t;
+
+/* A live block */
+typedef struct {
+    uintptr_t ptr;         /* 0 if the entry is unused */
+    uint64_t id;
+    uint64_t size;
+    int stream;            /* trace it was allocated in */
+} entry_t;
+
+/* The real allocator */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+static char boot_buf[BOOT_BYTES] __attribute__((aligned(16)));
+static size_t boot_used;
+
+/* State; everything below is under lock once ready is set */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int state;          /* 0 before setup, 1 during, 2 recording, 3 done */
+static pid_t owner;        /* the process writing the traces */
+static int binary, per_thread;
+static char out_path[MAXLINE];
+static stream_t streams[MAX_STREAMS];
+static int num_streams;
+static entry_t *table;
+static size_t mask, live;  /* table size - 1; entries in use */
+static uint64_t unknown_frees;
+
+static __thread int my_stream __attribute__((tls_model("initial-exec"))) = -1;
+static __thread int busy __attribute__((tls_model("initial-exec")));
+
+/*********************************************************
+ * Output
+ ********************************************************/
+
+static void *map(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        static const char m[] = "mmrecord: out of memory\n";
+        write(2, m, sizeof(m) - 1);
+        _exit(1);
+    }
+    return p;
+}
+
+static void flush(stream_t *s)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < s->len) {
+        if ((n = write(s->fd, s->buf + off, s->len - off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        off += n;
+    }
+    s->len = 0;
+}
+
+/*
+ * put_u64 - Append v in decimal
+ */
+static inline char *put_u64(char *p, uint64_t v)
+{
+    char tmp[20];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+/*
+ * emit - Append a request to stream s
+ */
+static void emit(stream_t *s, int type, uint64_t id, uint64_t size)
+{
+    static const char tc[] = {'a', 'f', 'r'};
+    char *p;
+
+    if (s->len > BUF_BYTES - 64)
+        flush(s);
+    p = s->buf + s->len;
+    if (binary) {
+        *p++ = type;
+        p += trace_put_varint((unsigned char *)p, id);
+        if (type != TRACE_FREE)
+            p += trace_put_varint((unsigned char *)p, size);
+    }
+    else {
+        *p++ = tc[type];
+        *p++ = ' ';
+        p = put_u64(p, id);
+        if (type != TRACE_FREE) {
+            *p++ = ' ';
+            p = put_u64(p, size);
+        }
+        *p++ = '\n';
+    }
+    s->len = p - s->buf;
+    s->num_ops++;
+}
+
+/*
+ * write_header - The trace header, first as a placeholder and at exit
+ *     with the counts. Text header lines have a fixed width so the
+ *     second write fits over the first.
+ */
+static void write_header(stream_t *s)
+{
+    char text[4 * (HDR_WIDTH + 1) + 1];
+    trace_hdr_t hdr;
+    uint64_t v[4];
+    int i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.flags = TRACE_VARINT;
+    hdr.sugg_heapsize = (s->peak_bytes > INT32_MAX) ? INT32_MAX
+                                                    : s->peak_bytes;
+    hdr.weight = 1;
+    hdr.num_ids = s->num_ids;
+    hdr.num_ops = s->num_ops;
+    if (binary) {
+        hdr.data_bytes = lseek(s->fd, 0, SEEK_END) - sizeof(hdr);
+        pwrite(s->fd, &hdr, sizeof(hdr), 0);
+        return;
+    }
+    v[0] = hdr.sugg_heapsize;
+    v[1] = hdr.num_ids;
+    v[2] = hdr.num_ops;
+    v[3] = hdr.weight;
+    memset(text, ' ', sizeof(text));
+    for (i = 0; i < 4; i++) {
+        put_u64(text + i * (HDR_WIDTH + 1), v[i]);
+        text[i * (HDR_WIDTH + 1) + HDR_WIDTH] = '\n';
+    }
+    pwrite(s->fd, text, 4 * (HDR_WIDTH + 1), 0);
+}
+
+/*
+ * open_stream - Start trace number n
+ */
+static int open_stream(int n)
+{
+    char path[MAXLINE + 16], *p = path;
+    stream_t *s = &streams[n];
+    const char *q;
+
+    for (q = out_path; *q != '\0' && p < path + MAXLINE; q++) {
+        if (q[0] == '%' && q[1] == 'p') {
+            p = put_u64(p, getpid());
+            q++;
+        }
+        else
+            *p++ = *q;
+    }
+    if (per_thread) {
+        *p++ = '.';
+        p = put_u64(p, n);
+    }
+    *p = '\0';
+    if ((s->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0)
+        return 0;
+    s->buf = map(BUF_BYTES);
+    s->len = 0;
+    write_header(s);
+    lseek(s->fd, 0, SEEK_END);
+    return 1;
+}
+
+/*********************************************************
+ * Live blocks, by address
+ ********************************************************/
+
+static inline size_t slot_of(uintptr_t ptr)
+{
+    return (size_t)((ptr >> 4) * 0x9E3779B97F4A7C15ull >> 20) & mask;
+}
+
+static size_t find(uintptr_t ptr)
+{
+    size_t i = slot_of(ptr);
+
+    while (table[i].ptr != 0 && table[i].ptr != ptr)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void grow(void)
+{
+    entry_t *old = table;
+    size_t i, n = mask + 1;
+
+    table = map(2 * n * sizeof(entry_t));
+    mask = 2 * n - 1;
+    for (i = 0; i < n; i++)
+        if (old[i].ptr != 0)
+            table[find(old[i].ptr)] = old[i];
+    munmap(old, n * sizeof(entry_t));
+}
+
+/* Empty entry i, moving later entries of its run back into the gap */
+static void erase(size_t i)
+{
+    size_t j = i, home;
+
+    for (;;) {
+        table[i].ptr = 0;
+        do {
+            j = (j + 1) & mask;
+            if (table[j].ptr == 0)
+                return;
+            home = slot_of(table[j].ptr);
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        table[i] = table[j];
+        i = j;
+    }
+}
+
+/*********************************************************
+ * Recording
+ ********************************************************/
+
+/*
+ * stream_here - The trace this thread writes new blocks to
+ */
+static int stream_here(void)
+{
+    if (!per_thread)
+        return 0;
+    if (my_stream < 0) {
+        if (num_streams < MAX_STREAMS && open_stream(num_streams))
+            my_stream = num_streams++;
+        else
+            my_stream = 0;
+    }
+    return my_stream;
+}
+
+static void record_alloc(void *p, size_t size)
+{
+    stream_t *s;
+    size_t i;
+    int n;
+
+    n = stream_here();
+    s = &streams[n];
+    i = find((uintptr_t)p);
+    if (table[i].ptr != 0) {         /* freed behind our back */
+        emit(&streams[table[i].stream], TRACE_FREE, table[i].id, 0);
+        streams[table[i].stream].live_bytes -= table[i].size;
+    }
+    else if (++live > mask / 2) {
+        grow();
+        i = find((uintptr_t)p);
+    }
+    table[i].ptr = (uintptr_t)p;
+    table[i].id = s->num_ids++;
+    table[i].size = size;
+    table[i].stream = n;
+    emit(s, TRACE_ALLOC, table[i].id, size);
+    if ((s->live_bytes += size) > s->peak_bytes)
+        s->peak_bytes = s->live_bytes;
+}
+
+static void record_free(void *p)
+{
+    size_t i = find((uintptr_t)p);
+    stream_t *s;
+
+    if (table[i].ptr == 0) {
+        unknown_frees++;
+        return;
+    }
+    s = &streams[table[i].stream];
+    emit(s, TRACE_FREE, table[i].id, 0);
+    s->live_bytes -= table[i].size;
+    erase(i);
+    live--;
+}
+
+static void record_realloc(void *old, void *p, size_t size)
+{
+    size_t i = find((uintptr_t)old);
+    entry_t e;
+    stream_t *s;
+
+    if (table[i].ptr == 0) {        /* never seen: a new block to us */
+        unknown_frees++;
+        record_alloc(p, size);
+        return;
+    }
+    e = table[i];
+    s = &streams[e.stream];
+    emit(s, TRACE_REALLOC, e.id, size);
+    s->live_bytes += size - e.size;
+    if (s->live_bytes > s->peak_bytes)
+        s->peak_bytes = s->live_bytes;
+    e.ptr = (uintptr_t)p;
+    e.size = size;
+    if (p != old) {
+        erase(i);
+        i = find((uintptr_t)p);
+    }
+    table[i] = e;
+}
+
+/*
+ * finish - Free what is still live, finish the headers, stop recording
+ */
+static void finish(void)
+{
+    size_t i;
+    int n;
+
+    pthread_mutex_lock(&lock);
+    if (state == 2 && owner == getpid()) {
+        for (i = 0; i <= mask; i++)
+            if (table[i].ptr != 0)
+                emit(&streams[table[i].stream], TRACE_FREE, table[i].id, 0);
+        for (n = 0; n < num_streams; n++) {
+            flush(&streams[n]);
+            write_header(&streams[n]);
+            close(streams[n].fd);
+        }
+        if (unknown_frees > 0) {
+            static const char m[] = " frees of unknown blocks left out\n";
+            char msg[80], *p;
+            p = put_u64(msg + 10, unknown_frees);
+            memcpy(msg, "mmrecord: ", 10);
+            memcpy(p, m, sizeof(m) - 1);
+            write(2, msg, p + sizeof(m) - 1 - msg);
+        }
+    }
+    state = 3;
+    pthread_mutex_unlock(&lock);
+}
+
+/* A forked child must not write to its parent's traces */
+static void fork_child(void)
+{
+    state = 3;
+    pthread_mutex_init(&lock, NULL);
+}
+
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+static void fork_parent(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * setup - Find the real functions and open the trace. Runs on the
+ *     first call; allocations made meanwhile come from boot_buf.
+ */
+static void setup(void)
+{
+    char *s;
+    int idle = 0;
+
+    if (!__atomic_compare_exchange_n(&state, &idle, 1, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE))
+        return;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+
+    s = getenv("MMREC_OUT");
+    strncpy(out_path, (s && *s) ? s : "mmrecord.%p.rep", MAXLINE - 1);
+    per_thread = (s = getenv("MMREC_THREADS")) != NULL && *s == '1';
+    binary = (s = getenv("MMREC_BINARY")) != NULL && *s == '1';
+    owner = getpid();
+
+    mask = 4095;
+    table = map((mask + 1) * sizeof(entry_t));
+    num_streams = 1;
+    my_stream = 0;
+    if (!open_stream(0)) {
+        static const char m[] = "mmrecord: could not create the trace\n";
+        write(2, m, sizeof(m) - 1);
+        __atomic_store_n(&state, 3, __ATOMIC_RELEASE);
+        return;
+    }
+    __atomic_store_n(&state, 2, __ATOMIC_RELEASE);
+}
+
+__attribute__((constructor))
+static void mmrecord_init(void)
+{
+    busy++;
+    setup();
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    atexit(finish);
+    busy--;
+}
+
+/* Wait out another thread's setup; returns 1 if this call is recorded */
+static inline int recording(void)
+{
+    int st;
+
+    if ((st = __atomic_load_n(&state, __ATOMIC_ACQUIRE)) == 0) {
+        busy++;
+        setup();
+        busy--;
+        st = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+    }
+    while (st == 1 && !busy)        /* another thread is setting up */
+        st = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+    return st == 2 && !busy;
+}
+
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_BYTES)
+        return NULL;
+    p = boot_buf + boot_used;
+    boot_used += size;
+    return p;
+}
+
+static inline int is_boot(void *p)
+{
+    return (char *)p >= boot_buf && (char *)p < boot_buf + BOOT_BYTES;
+}
+
+/*********************************************************
+ * The C library allocation interface
+ ********************************************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (!recording()) {
+        if (real_malloc == NULL)
+            return boot_alloc(size);
+        return real_malloc(size);
+    }
+    busy++;
+    p = real_malloc(size);
+    if (p != NULL) {
+        pthread_mutex_lock(&lock);
+        record_alloc(p, size);
+        pthread_mutex_unlock(&lock);
+    }
+    busy--;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_boot(ptr) || real_free == NULL)
+        return;
+    if (recording()) {
+        busy++;
+        pthread_mutex_lock(&lock);
+        record_free(ptr);
+        pthread_mutex_unlock(&lock);
+        busy--;
+    }
+    real_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (!recording()) {
+        if (real_calloc == NULL)
+            return boot_alloc(nmemb * size);   /* boot_buf is zeroed */
+        return real_calloc(nmemb, size);
+    }
+    busy++;
+    p = real_calloc(nmemb, size);
+    if (p != NULL) {
+        pthread_mutex_lock(&lock);
+        record_alloc(p, nmemb * size);
+        pthread_mutex_unlock(&lock);
+    }
+    busy--;
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+        return malloc(size);
+    if (is_boot(ptr)) {         /* move it to the real heap */
+        size_t n = boot_buf + BOOT_BYTES - (char *)ptr;
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, n < size ? n : size);
+        return p;
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!recording())
+        return real_realloc(ptr, size);
+    busy++;
+    p = real_realloc(ptr, size);
+    if (p != NULL) {
+        pthread_mutex_lock(&lock);
+        record_realloc(ptr, p, size);
+        pthread_mutex_unlock(&lock);
+    }
+    busy--;
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (!recording())
+        return real_memalign(align, size);
+    busy++;
+    p = real_memalign(align, size);
+    if (p != NULL) {
+        pthread_mutex_lock(&lock);
+        record_alloc(p, size);
+        pthread_mutex_unlock(&lock);
+    }
+    busy--;
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
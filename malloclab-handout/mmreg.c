@@ -0,0 +1,37 @@
+/*
+ * mmreg.c - The registry of malloc packages (see mmreg.h)
+ *
+ * Compiled with -DMM_ALL for mdriver-all. A variant added to VARIANTS
+ * in the Makefile also needs its VARIANT and ENTRY lines here.
+ */
+#include "mm.h"
+#include "mmreg.h"
+
+#ifdef MM_ALL
+#define VARIANT(p)                                      \
+    extern team_t p##_team;                             \
+    extern int p##_mm_init(void);                       \
+    extern void *p##_mm_malloc(size_t size);            \
+    extern void p##_mm_free(void *ptr);                 \
+    extern void *p##_mm_realloc(void *ptr, size_t size);
+
+#define ENTRY(p) \
+    {#p, &p##_team, p##_mm_init, p##_mm_malloc, p##_mm_free, p##_mm_realloc, \
+     NULL}
+
+VARIANT(ex_first)
+VARIANT(im_first)
+VARIANT(im_next)
+VARIANT(seg_best)
+#endif
+
+mm_alloc_t mm_allocs[] = {
+    {"mm", &team, mm_init, mm_malloc, mm_free, mm_realloc, mm_mmap_threshold},
+#ifdef MM_ALL
+    ENTRY(ex_first),
+    ENTRY(im_first),
+    ENTRY(im_next),
+    ENTRY(seg_best),
+#endif
+    {NULL}
+};
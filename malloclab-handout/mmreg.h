@@ -0,0 +1,23 @@
+/*
+ * mmreg.h - The malloc packages mdriver can run
+ *
+ * An ordinary build runs mm.c alone. make mdriver-all also compiles
+ * each allocator in the Makefile's VARIANTS with its symbols prefixed
+ * by its name (mm_malloc becomes im_first_mm_malloc, and so on), so one
+ * run of mdriver-all scores all of them side by side. Include mm.h
+ * first.
+ */
+#include <stddef.h>
+
+typedef struct {
+    const char *name;
+    team_t *team;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*mmap_threshold)(size_t bytes);   /* NULL if not offered */
+} mm_alloc_t;
+
+/* The packages built in, mm.c first; ends with a NULL name */
+extern mm_alloc_t mm_allocs[];
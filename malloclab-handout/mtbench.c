@@ -0,0 +1,222 @@
+/*
+ * mtbench.c - Multithreaded benchmark for the mm.c front end caches
+ *
+ * Runs the same small-object workload on T threads against one mm heap
+ * with the front end off (one lock around mm_*), with a cache per thread,
+ * and with a cache per CPU, and reports throughput and memory for each.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Defaults, overridden by the command line */
+#define DEF_OPS     200000  /* malloc+free pairs per thread */
+#define DEF_LIVE    512     /* live blocks per thread */
+#define MAXSIZE     128     /* most requests are 1..MAXSIZE bytes */
+#define BIGSIZE     1024    /* one in BIGFRAC requests is up to BIGSIZE */
+#define BIGFRAC     16
+
+/* Front end selections, in the order they are run */
+static int modes[] = {MM_CACHE_OFF, MM_CACHE_THREAD, MM_CACHE_CPU};
+static char *mode_names[] = {"lock", "thread", "cpu"};
+
+/* Per-thread parameters */
+typedef struct {
+    pthread_t tid;
+    unsigned seed;
+    int ops;
+    int live;
+} worker_t;
+
+static int cur_mode;
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void unix_error(char *msg);
+static void usage(void);
+
+/*
+ * bench_malloc, bench_free - mm_* with the lock only needed when the
+ *     front end is off
+ */
+static void *bench_malloc(size_t size)
+{
+    void *p;
+
+    if (cur_mode != MM_CACHE_OFF)
+        return mm_malloc(size);
+    pthread_mutex_lock(&big_lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&big_lock);
+    return p;
+}
+
+static void bench_free(void *p)
+{
+    if (cur_mode != MM_CACHE_OFF) {
+        mm_free(p);
+        return;
+    }
+    pthread_mutex_lock(&big_lock);
+    mm_free(p);
+    pthread_mutex_unlock(&big_lock);
+}
+
+/*
+ * worker - Replace a random one of the thread's live blocks, ops times
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    char **blocks;
+    size_t size;
+    int i, j;
+
+    if ((blocks = calloc(w->live, sizeof(char *))) == NULL)
+        unix_error("calloc failed in worker");
+
+    for (i = 0; i < w->ops; i++) {
+        j = rand_r(&w->seed) % w->live;
+        if (blocks[j] != NULL)
+            bench_free(blocks[j]);
+        if (rand_r(&w->seed) % BIGFRAC == 0)
+            size = 1 + rand_r(&w->seed) % BIGSIZE;
+        else
+            size = 1 + rand_r(&w->seed) % MAXSIZE;
+        if ((blocks[j] = bench_malloc(size)) == NULL) {
+            fprintf(stderr, "mm_malloc failed (heap exhausted?)\n");
+            exit(1);
+        }
+        blocks[j][0] = (char)i;
+    }
+
+    for (j = 0; j < w->live; j++)
+        if (blocks[j] != NULL)
+            bench_free(blocks[j]);
+    free(blocks);
+    return NULL;
+}
+
+/*
+ * run - Time one mode on nthreads threads and print a result line
+ */
+static void run(int m, int nthreads, int ops, int live)
+{
+    worker_t *w;
+    struct timeval start, end;
+    mm_stats_t st;
+    double secs;
+    int i;
+
+    if ((w = calloc(nthreads, sizeof(worker_t))) == NULL)
+        unix_error("calloc failed in run");
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    cur_mode = modes[m];
+    mm_cache_mode(cur_mode);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++) {
+        w[i].seed = i + 1;
+        w[i].ops = ops;
+        w[i].live = live;
+        if ((errno = pthread_create(&w[i].tid, NULL, worker, &w[i])) != 0)
+            unix_error("pthread_create failed");
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(w[i].tid, NULL);
+    gettimeofday(&end, NULL);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    mm_stats(&st);
+    printf("%-7s%8d%10.0f%12lu%12lu%8lu\n", mode_names[m], nthreads,
+           2.0 * ops * nthreads / 1e3 / secs,
+           (unsigned long)mem_heapsize(), (unsigned long)st.c_bytes,
+           (unsigned long)st.c_caches);
+    mm_cache_mode(MM_CACHE_OFF);
+    free(w);
+}
+
+int main(int argc, char **argv)
+{
+    int nthreads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    int ops = DEF_OPS;
+    int live = DEF_LIVE;
+    int only = -1;
+    int c, m;
+
+    while ((c = getopt(argc, argv, "t:n:l:m:h")) != EOF) {
+        switch (c) {
+        case 't': /* Number of threads */
+            nthreads = atoi(optarg);
+            break;
+        case 'n': /* Operations per thread */
+            ops = atoi(optarg);
+            break;
+        case 'l': /* Live blocks per thread */
+            live = atoi(optarg);
+            break;
+        case 'm': /* Run one mode only */
+            for (m = 0; m < 3; m++)
+                if (!strcmp(optarg, mode_names[m]))
+                    only = m;
+            if (only < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (nthreads < 1 || ops < 1 || live < 1) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    printf("%-7s%8s%10s%12s%12s%8s\n",
+           "mode", "threads", "Kops", "heap", "cached", "caches");
+    for (m = 0; m < 3; m++)
+        if (only < 0 || only == m)
+            run(m, nthreads, ops, live);
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-h] [-t <threads>] [-n <ops>] [-l <live>] [-m lock|thread|cpu]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l <live>  Live blocks per thread (default %d).\n", DEF_LIVE);
+    fprintf(stderr, "\t-m <mode>  Run only this front end.\n");
+    fprintf(stderr, "\t-n <ops>   Malloc/free pairs per thread (default %d).\n", DEF_OPS);
+    fprintf(stderr, "\t-t <n>     Number of threads (default 2 per CPU).\n");
+}
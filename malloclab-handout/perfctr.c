@@ -0,0 +1,132 @@
+/*
+ * perfctr.c - Hardware performance counters with perf_event_open
+ */
+#include <string.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+const char *pc_names[PC_NUM] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "dTLB-miss", "br-miss",
+    "faults"
+};
+
+static int fds[PC_NUM] = {-1, -1, -1, -1, -1, -1, -1};
+
+#ifdef __linux__
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+    unsigned type;
+    unsigned long long config;
+} events[PC_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+                                     PERF_COUNT_HW_CACHE_OP_READ,
+                                     PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_LL,
+                                     PERF_COUNT_HW_CACHE_OP_READ,
+                                     PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+                                     PERF_COUNT_HW_CACHE_OP_READ,
+                                     PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+/*
+ * pc_open - Open each counter for this thread, user mode only, which
+ *     needs no privileges at the default perf_event_paranoid level.
+ *     The counters start disabled.
+ */
+int pc_open(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PC_NUM; i++) {
+        if (fds[i] >= 0) {
+            n++;
+            continue;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] >= 0)
+            n++;
+    }
+    return n;
+}
+
+void pc_start(void)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+/*
+ * pc_stop - Stop the counters and read them. When there are more
+ *     counters than the CPU has registers the kernel takes turns
+ *     among them, and a count is scaled up by the share of the run it
+ *     was live for.
+ */
+void pc_stop(double vals[PC_NUM])
+{
+    unsigned long long buf[3];  /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+        if (fds[i] >= 0)
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PC_NUM; i++) {
+        vals[i] = -1;
+        if (fds[i] < 0 || read(fds[i], buf, sizeof(buf)) != sizeof(buf) ||
+            buf[2] == 0)        /* never got a register */
+            continue;
+        if (buf[2] < buf[1])
+            vals[i] = (double)buf[0] * buf[1] / buf[2];
+        else
+            vals[i] = buf[0];
+    }
+}
+
+#else /* !__linux__ */
+
+int pc_open(void)
+{
+    return 0;
+}
+
+void pc_start(void)
+{
+}
+
+void pc_stop(double vals[PC_NUM])
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+        vals[i] = -1;
+}
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * perfctr.h - Hardware performance counters around a timed run (mdriver -P)
+ *
+ * Counts the calling thread's user-mode events with perf_event_open.
+ * Each counter is opened on its own, so one the kernel or CPU does not
+ * offer is left out rather than taking the others with it.
+ */
+enum {
+    PC_CYCLES,
+    PC_INSTRS,
+    PC_L1D_MISS,
+    PC_LLC_MISS,
+    PC_DTLB_MISS,
+    PC_BR_MISS,
+    PC_FAULTS,
+    PC_NUM
+};
+
+/* Short column names, indexed as above */
+extern const char *pc_names[PC_NUM];
+
+/* Open the counters; returns how many could be opened */
+int pc_open(void);
+
+/* Zero the open counters and start them */
+void pc_start(void);
+
+/* Stop the counters and store their counts in vals; -1 if not open */
+void pc_stop(double vals[PC_NUM]);
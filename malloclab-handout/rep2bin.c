@@ -0,0 +1,144 @@
+/*
+ * rep2bin.c - Convert a .rep text trace to the binary format of tracefmt.h
+ *
+ * mdriver maps binary traces instead of parsing them, and it tells the
+ * two formats apart by the header, so a binary trace can stand in for
+ * a .rep file anywhere. With -z the requests are varint coded, which
+ * is smaller on disk, takes 64-bit ids and sizes, and is decoded when
+ * the trace is read. Requests are converted as they are read, so any
+ * length of trace converts in a fixed amount of memory.
+ *
+ * usage: rep2bin [-z] trace.rep trace.bin
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "tracefmt.h"
+
+#define MAXLINE  1024
+
+static char *inpath, *outpath;
+static FILE *out;
+
+static void fail(long line, const char *what)
+{
+    fprintf(stderr, "rep2bin: %s:%ld: %s\n", inpath, line, what);
+    exit(1);
+}
+
+static void put(const void *p, size_t n)
+{
+    if (fwrite(p, n, 1, out) != 1) {
+        fprintf(stderr, "rep2bin: error writing %s\n", outpath);
+        exit(1);
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rep2bin [-z] trace.rep trace.bin\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    trace_hdr_t hdr;
+    trace_rec_t rec;
+    unsigned char buf[1 + 2*10], *q;
+    char line[MAXLINE], *s, *e;
+    unsigned long long index, size;
+    uint64_t n = 0;
+    long lineno;
+    int c, type, zip = 0;
+
+    while ((c = getopt(argc, argv, "z")) != EOF) {
+        if (c != 'z')
+            usage();
+        zip = 1;
+    }
+    if (optind != argc - 2)
+        usage();
+    inpath = argv[optind];
+    outpath = argv[optind+1];
+    if ((fp = fopen(inpath, "r")) == NULL) {
+        fprintf(stderr, "rep2bin: could not open %s\n", inpath);
+        exit(1);
+    }
+    if ((out = fopen(outpath, "wb")) == NULL) {
+        fprintf(stderr, "rep2bin: could not create %s\n", outpath);
+        exit(1);
+    }
+
+    /* Header: the four numbers that open every .rep file */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    if (fscanf(fp, "%" SCNd32 " %" SCNu64 " %" SCNu64 " %" SCNd32,
+               &hdr.sugg_heapsize, &hdr.num_ids, &hdr.num_ops,
+               &hdr.weight) != 4)
+        fail(1, "bad header");
+    lineno = 3;  /* the next fgets finishes line 4 */
+    hdr.flags = zip ? TRACE_VARINT : 0;
+
+    /* The header goes in again at the end, when data_bytes is known */
+    put(&hdr, sizeof(hdr));
+
+    /* Requests, one per line */
+    while (fgets(line, MAXLINE, fp) != NULL) {
+        lineno++;
+        for (s = line; *s == ' ' || *s == '\t'; s++)
+            ;
+        if (*s == '\n' || *s == '\0')
+            continue;
+        switch (*s) {
+        case 'a': type = TRACE_ALLOC;   break;
+        case 'r': type = TRACE_REALLOC; break;
+        case 'f': type = TRACE_FREE;    break;
+        default:  fail(lineno, "bogus type character");
+        }
+        index = strtoull(s + 1, &e, 10);
+        if (e == s + 1)
+            fail(lineno, "bad block id");
+        size = 0;
+        if (type != TRACE_FREE) {
+            s = e;
+            size = strtoull(s, &e, 10);
+            if (e == s)
+                fail(lineno, "bad size");
+        }
+        if (zip) {
+            q = buf;
+            *q++ = (unsigned char)type;
+            q += trace_put_varint(q, index);
+            if (type != TRACE_FREE)
+                q += trace_put_varint(q, size);
+            put(buf, q - buf);
+            hdr.data_bytes += q - buf;
+        }
+        else {
+            if (index > INT32_MAX || size > INT32_MAX)
+                fail(lineno, "id or size too big for records; use -z");
+            rec.type = type;
+            rec.index = index;
+            rec.size = size;
+            put(&rec, sizeof(rec));
+            hdr.data_bytes += sizeof(rec);
+        }
+        n++;
+    }
+    fclose(fp);
+    if (n != hdr.num_ops)
+        fail(lineno, "number of requests differs from the header");
+
+    if (fseek(out, 0, SEEK_SET) != 0)
+        fail(lineno, "output must be a file, not a pipe");
+    put(&hdr, sizeof(hdr));
+    if (fclose(out) != 0) {
+        fprintf(stderr, "rep2bin: error writing %s\n", outpath);
+        exit(1);
+    }
+    exit(0);
+}
@@ -0,0 +1,75 @@
+/*
+ * tracefmt.h - Binary trace format read by mdriver and written by rep2bin
+ *
+ * A binary trace is a trace_hdr_t followed by data_bytes of requests,
+ * in host byte order. Without TRACE_VARINT the requests are num_ops
+ * trace_rec_t records, laid out so the driver can map the file and
+ * replay the records where they lie. With TRACE_VARINT each request
+ * is a type byte followed by the index and, unless it is a free, the
+ * size, each as a little-endian base-128 varint. Records hold 31-bit
+ * ids and sizes; the varint coding takes any 64-bit value, for traces
+ * that are only ever streamed (mdriver -s).
+ */
+#include <stdint.h>
+
+#define TRACE_MAGIC    "MMTRACE2"  /* first 8 bytes of every binary trace */
+#define TRACE_VARINT   0x1         /* flags: requests are varint coded */
+
+/* Request types, as stored in a record */
+#define TRACE_ALLOC    0
+#define TRACE_FREE     1
+#define TRACE_REALLOC  2
+
+typedef struct {
+    char magic[8];          /* TRACE_MAGIC, not null terminated */
+    uint32_t flags;         /* TRACE_VARINT or 0 */
+    int32_t sugg_heapsize;  /* the four numbers heading a .rep file */
+    int32_t weight;
+    uint32_t pad;
+    uint64_t num_ids;
+    uint64_t num_ops;
+    uint64_t data_bytes;    /* bytes of requests after the header */
+} trace_hdr_t;
+
+typedef struct {
+    int32_t type;           /* TRACE_ALLOC, TRACE_FREE or TRACE_REALLOC */
+    int32_t index;          /* block id */
+    int32_t size;           /* payload bytes; 0 for a free */
+} trace_rec_t;
+
+/*
+ * trace_put_varint - Store v at p, return the number of bytes used (1-10)
+ */
+static inline int trace_put_varint(unsigned char *p, uint64_t v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/*
+ * trace_get_varint - Load a varint from *pp, advancing *pp past it.
+ *     Returns 0 if it runs past end or is longer than 10 bytes.
+ */
+static inline int trace_get_varint(const unsigned char **pp,
+                                   const unsigned char *end, uint64_t *v)
+{
+    const unsigned char *p = *pp;
+    uint64_t x = 0;
+    int shift;
+
+    for (shift = 0; shift < 70 && p < end; shift += 7) {
+        x |= (uint64_t)(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) {
+            *v = x;
+            *pp = p;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,560 @@
+/*
+ * tracegen.c - Generate synthetic traces for mdriver at any scale
+ *
+ * Each block gets a size from a size model and a lifetime from a
+ * lifetime model, and is freed when its lifetime runs out. Lifetimes
+ * are scaled so about -L blocks are live once the trace warms up,
+ * and the trace frees everything that is still live at the end, as
+ * the -bal traces do. Ids run from 0 up, so the traces also load in
+ * mdriver without -s.
+ *
+ * usage: tracegen [options] out.rep
+ *
+ *   -n ops      requests in the trace (default 100000)
+ *   -L blocks   blocks live at once (default 1000)
+ *   -s model    sizes (default uniform:1:512):
+ *                 uniform:LO:HI        evenly between LO and HI
+ *                 power:LO:HI:ALPHA    Pareto from LO with tail ALPHA,
+ *                                      cut off at HI
+ *                 bimodal:A:B:P        A with probability P, else B
+ *                 hist:FILE            "size count" lines, e.g. from a
+ *                                      production allocation profile
+ *   -l model    lifetimes (default exp):
+ *                 exp                  memoryless
+ *                 uniform              evenly up to twice the mean
+ *                 pareto               most die young, a few live long
+ *                 fixed                all the same
+ *   -r P:G      realloc a live block with probability P per allocation,
+ *               growing it by factor G (G < 1 shrinks it)
+ *   -p N:F      N phases; odd-numbered phases scale sizes by F
+ *   -a          adversarial: leave holes pinned between live blocks,
+ *               then ask only for sizes too big to fit them
+ *   -b, -z      write binary records, or varint coded binary
+ *   -S seed     random seed (default 1)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "tracefmt.h"
+
+#define MAXLINE    1024
+#define MAX_SIZE   0x7fffffff   /* largest request mdriver loads */
+
+enum {OUT_TEXT, OUT_RECS, OUT_VARINT};
+enum {S_UNIFORM, S_POWER, S_BIMODAL, S_HIST};
+enum {L_EXP, L_UNIFORM, L_PARETO, L_FIXED};
+
+/* A live block; the slot also records where it sits in heap and live */
+typedef struct {
+    uint64_t id;
+    uint64_t size;
+    uint64_t death;     /* request number it is freed at */
+    size_t heap_pos;
+    size_t live_pos;
+} slot_t;
+
+/* Models, from the command line */
+static uint64_t num_ops = 100000;
+static uint64_t target_live = 1000;
+static int size_model = S_UNIFORM;
+static double s_lo = 1, s_hi = 512, s_alpha = 1.5, s_p = 0.5;
+static double *hist_size, *hist_cum;  /* -s hist: sizes, running counts */
+static int hist_len;
+static int life_model = L_EXP;
+static double realloc_p = 0, realloc_g = 1.5;
+static int phases = 1;
+static double phase_f = 1;
+static int adversarial = 0;
+static int out_fmt = OUT_TEXT;
+
+/* Output */
+static FILE *out;
+static char *outpath;
+static trace_hdr_t hdr;         /* counts, filled in as requests go out */
+static uint64_t live_bytes, peak_bytes;
+
+/* Live blocks: slots, a min-heap on death, and a list to pick from */
+static slot_t *slots;
+static size_t *free_slots, num_free, num_slots, max_slots;
+static size_t *heap, heap_len;
+static size_t *live, live_len;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: tracegen [-n ops] [-L blocks] [-s model] "
+            "[-l model] [-r P:G]\n"
+            "                [-p N:F] [-a] [-b|-z] [-S seed] out.rep\n");
+    exit(1);
+}
+
+static void fail(const char *what, const char *arg)
+{
+    fprintf(stderr, "tracegen: %s: %s\n", what, arg);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t bytes)
+{
+    if ((p = realloc(p, bytes)) == NULL) {
+        fprintf(stderr, "tracegen: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*********************************************************
+ * Random numbers: xorshift64*
+ ********************************************************/
+
+static uint64_t rng_state = 1;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+/* Uniform in (0, 1) */
+static double unif(void)
+{
+    return ((rng() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*********************************************************
+ * Models
+ ********************************************************/
+
+/*
+ * read_hist - Load a "size count" histogram for -s hist
+ */
+static void read_hist(char *path)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    double size, count, total = 0;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        fail("could not open", path);
+    while (fgets(line, MAXLINE, fp) != NULL) {
+        if (sscanf(line, "%lf %lf", &size, &count) != 2 || count <= 0)
+            continue;
+        hist_size = xrealloc(hist_size, (hist_len + 1) * sizeof(double));
+        hist_cum = xrealloc(hist_cum, (hist_len + 1) * sizeof(double));
+        total += count;
+        hist_size[hist_len] = size;
+        hist_cum[hist_len++] = total;
+    }
+    fclose(fp);
+    if (hist_len == 0)
+        fail("no \"size count\" lines in", path);
+}
+
+/*
+ * parse_sizes - Set the size model from -s
+ */
+static void parse_sizes(char *arg)
+{
+    if (sscanf(arg, "uniform:%lf:%lf", &s_lo, &s_hi) == 2)
+        size_model = S_UNIFORM;
+    else if (sscanf(arg, "power:%lf:%lf:%lf", &s_lo, &s_hi, &s_alpha) == 3)
+        size_model = S_POWER;
+    else if (sscanf(arg, "bimodal:%lf:%lf:%lf", &s_lo, &s_hi, &s_p) == 3)
+        size_model = S_BIMODAL;
+    else if (!strncmp(arg, "hist:", 5)) {
+        size_model = S_HIST;
+        read_hist(arg + 5);
+        return;
+    }
+    else
+        fail("bad size model", arg);
+    if (s_lo < 1 || s_hi < s_lo || s_alpha <= 0 || s_p < 0 || s_p > 1)
+        fail("bad size model", arg);
+}
+
+/*
+ * draw_size - A request size from the size model, in phase phase
+ */
+static uint64_t draw_size(int phase)
+{
+    double s, u = unif();
+    int lo, hi, mid;
+
+    switch (size_model) {
+    case S_UNIFORM:
+        s = s_lo + u * (s_hi - s_lo + 1);
+        break;
+    case S_POWER:
+        s = s_lo * pow(u, -1.0 / s_alpha);
+        if (s > s_hi)
+            s = s_hi;
+        break;
+    case S_BIMODAL:
+        s = (u < s_p) ? s_lo : s_hi;
+        break;
+    default: /* S_HIST */
+        u *= hist_cum[hist_len - 1];
+        for (lo = 0, hi = hist_len - 1; lo < hi; ) {
+            mid = (lo + hi) / 2;
+            if (hist_cum[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        s = hist_size[lo];
+        break;
+    }
+    if (phase & 1)
+        s *= phase_f;
+    if (s < 1)
+        s = 1;
+    return (s > MAX_SIZE) ? MAX_SIZE : (uint64_t)s;
+}
+
+/*
+ * draw_life - A lifetime in requests. Allocations are about half of
+ *     the requests, so a mean of 2L keeps about L blocks live.
+ */
+static uint64_t draw_life(void)
+{
+    double mean = 2.0 * target_live, u = unif(), t;
+
+    switch (life_model) {
+    case L_EXP:
+        t = -mean * log(u);
+        break;
+    case L_UNIFORM:
+        t = 2 * mean * u;
+        break;
+    case L_PARETO:      /* tail 1.5, scaled to the same mean */
+        t = (mean / 3) * pow(u, -1.0 / 1.5);
+        break;
+    default: /* L_FIXED */
+        t = mean;
+        break;
+    }
+    return (uint64_t)t + 1;
+}
+
+/*********************************************************
+ * Output
+ ********************************************************/
+
+static void put(const void *p, size_t n)
+{
+    if (fwrite(p, n, 1, out) != 1)
+        fail("error writing", outpath);
+}
+
+/*
+ * write_header - The header, first as a placeholder and then again
+ *     with the final counts. Text headers are padded to a fixed width
+ *     so the second write fits over the first.
+ */
+static void write_header(void)
+{
+    if (out_fmt == OUT_TEXT) {
+        if (fprintf(out, "%20" PRId32 "\n%20" PRIu64 "\n%20" PRIu64
+                    "\n%20" PRId32 "\n", hdr.sugg_heapsize, hdr.num_ids,
+                    hdr.num_ops, hdr.weight) < 0)
+            fail("error writing", outpath);
+    }
+    else
+        put(&hdr, sizeof(hdr));
+}
+
+/*
+ * emit - Write one request
+ */
+static void emit(int type, uint64_t id, uint64_t size)
+{
+    static const char tc[] = {'a', 'f', 'r'};
+    unsigned char buf[1 + 2*10], *q;
+    trace_rec_t rec;
+
+    switch (out_fmt) {
+    case OUT_TEXT:
+        if (type == TRACE_FREE)
+            fprintf(out, "f %" PRIu64 "\n", id);
+        else
+            fprintf(out, "%c %" PRIu64 " %" PRIu64 "\n", tc[type], id, size);
+        break;
+    case OUT_RECS:
+        if (id > INT32_MAX)
+            fail("too many ids for records; use -z", outpath);
+        rec.type = type;
+        rec.index = id;
+        rec.size = size;
+        put(&rec, sizeof(rec));
+        hdr.data_bytes += sizeof(rec);
+        break;
+    default: /* OUT_VARINT */
+        q = buf;
+        *q++ = type;
+        q += trace_put_varint(q, id);
+        if (type != TRACE_FREE)
+            q += trace_put_varint(q, size);
+        put(buf, q - buf);
+        hdr.data_bytes += q - buf;
+        break;
+    }
+    hdr.num_ops++;
+}
+
+/*********************************************************
+ * Live blocks
+ ********************************************************/
+
+static void heap_swap(size_t a, size_t b)
+{
+    size_t t = heap[a];
+
+    heap[a] = heap[b];
+    heap[b] = t;
+    slots[heap[a]].heap_pos = a;
+    slots[heap[b]].heap_pos = b;
+}
+
+static void heap_up(size_t i)
+{
+    while (i > 0 && slots[heap[(i-1)/2]].death > slots[heap[i]].death) {
+        heap_swap(i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void heap_down(size_t i)
+{
+    size_t c;
+
+    while ((c = 2*i + 1) < heap_len) {
+        if (c + 1 < heap_len && slots[heap[c+1]].death < slots[heap[c]].death)
+            c++;
+        if (slots[heap[i]].death <= slots[heap[c]].death)
+            break;
+        heap_swap(i, c);
+        i = c;
+    }
+}
+
+/*
+ * block_alloc - Allocate a block that dies at death; returns its slot
+ */
+static size_t block_alloc(uint64_t size, uint64_t death)
+{
+    size_t s;
+
+    if (num_free > 0)
+        s = free_slots[--num_free];
+    else {
+        if (num_slots == max_slots) {
+            max_slots = 2*max_slots + 1024;
+            slots = xrealloc(slots, max_slots * sizeof(slot_t));
+            free_slots = xrealloc(free_slots, max_slots * sizeof(size_t));
+            heap = xrealloc(heap, max_slots * sizeof(size_t));
+            live = xrealloc(live, max_slots * sizeof(size_t));
+        }
+        s = num_slots++;
+    }
+    slots[s].id = hdr.num_ids++;
+    slots[s].size = size;
+    slots[s].death = death;
+    slots[s].heap_pos = heap_len;
+    heap[heap_len++] = s;
+    heap_up(heap_len - 1);
+    slots[s].live_pos = live_len;
+    live[live_len++] = s;
+
+    emit(TRACE_ALLOC, slots[s].id, size);
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+        peak_bytes = live_bytes;
+    return s;
+}
+
+/*
+ * block_free - Free the block in slot s
+ */
+static void block_free(size_t s)
+{
+    size_t i = slots[s].heap_pos, moved;
+
+    emit(TRACE_FREE, slots[s].id, 0);
+    live_bytes -= slots[s].size;
+
+    heap_swap(i, --heap_len);
+    if (i < heap_len) {
+        moved = heap[i];
+        heap_up(i);
+        heap_down(slots[moved].heap_pos);
+    }
+    live[slots[s].live_pos] = live[--live_len];
+    slots[live[slots[s].live_pos]].live_pos = slots[s].live_pos;
+    free_slots[num_free++] = s;
+}
+
+/*
+ * block_realloc - Resize the block in slot s
+ */
+static void block_realloc(size_t s, uint64_t size)
+{
+    emit(TRACE_REALLOC, slots[s].id, size);
+    live_bytes += size - slots[s].size;
+    slots[s].size = size;
+    if (live_bytes > peak_bytes)
+        peak_bytes = live_bytes;
+}
+
+/*********************************************************
+ * Generators
+ ********************************************************/
+
+/*
+ * gen_models - Requests from the size, lifetime and realloc models
+ */
+static void gen_models(void)
+{
+    uint64_t t, phase_len = num_ops / phases + 1;
+    double size;
+    size_t s;
+
+    /* An allocation adds a request now and its free later */
+    while ((t = hdr.num_ops) + live_len + 2 <= num_ops) {
+        if (heap_len > 0 && slots[heap[0]].death <= t)
+            block_free(heap[0]);
+        else if (live_len > 0 && realloc_p > 0 && unif() < realloc_p) {
+            s = live[rng() % live_len];
+            size = slots[s].size * realloc_g;
+            if (size < 1)
+                size = 1;
+            block_realloc(s, (size > MAX_SIZE) ? MAX_SIZE : (uint64_t)size);
+        }
+        else
+            block_alloc(draw_size(t / phase_len), t + draw_life());
+    }
+}
+
+/*
+ * gen_adversarial - Rounds that each allocate a run of blocks of one
+ *     size and free every other one. The blocks left pin the holes
+ *     between them, so the holes cannot coalesce, and every round asks
+ *     for a size a quarter bigger than the last, so no hole is reused.
+ *     Sizes go from LO to HI of -s and start over. Once L blocks are
+ *     live the oldest half are freed, which leaves the freed space in
+ *     odd sized pieces. Deaths are allocation order, so the heap top
+ *     is always the oldest block.
+ */
+static void gen_adversarial(void)
+{
+    uint64_t size = (uint64_t)s_lo, run = target_live / 4 + 1, i;
+    size_t *hole = xrealloc(NULL, run * sizeof(size_t));
+
+    /* A round adds 3*run requests and run live blocks to free later */
+    while (hdr.num_ops + live_len + 4 * run <= num_ops) {
+        for (i = 0; i < run; i++) {
+            hole[i] = block_alloc(size, hdr.num_ops);
+            block_alloc(size, hdr.num_ops);
+        }
+        for (i = 0; i < run; i++)
+            block_free(hole[i]);
+        if (live_len >= target_live)
+            for (i = live_len / 2; i > 0; i--)
+                block_free(heap[0]);
+        size = size + size / 4 + 8;
+        if (size > s_hi)
+            size = (uint64_t)s_lo;
+    }
+    free(hole);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "n:L:s:l:r:p:abzS:")) != EOF) {
+        switch (c) {
+        case 'n':
+            num_ops = strtoull(optarg, NULL, 0);
+            break;
+        case 'L':
+            if ((target_live = strtoull(optarg, NULL, 0)) == 0)
+                fail("bad live block count", optarg);
+            break;
+        case 's':
+            parse_sizes(optarg);
+            break;
+        case 'l':
+            if (!strcmp(optarg, "exp"))
+                life_model = L_EXP;
+            else if (!strcmp(optarg, "uniform"))
+                life_model = L_UNIFORM;
+            else if (!strcmp(optarg, "pareto"))
+                life_model = L_PARETO;
+            else if (!strcmp(optarg, "fixed"))
+                life_model = L_FIXED;
+            else
+                fail("bad lifetime model", optarg);
+            break;
+        case 'r':
+            if (sscanf(optarg, "%lf:%lf", &realloc_p, &realloc_g) != 2 ||
+                realloc_p < 0 || realloc_p > 1 || realloc_g <= 0)
+                fail("bad realloc model", optarg);
+            break;
+        case 'p':
+            if (sscanf(optarg, "%d:%lf", &phases, &phase_f) != 2 ||
+                phases < 1 || phase_f <= 0)
+                fail("bad phases", optarg);
+            break;
+        case 'a':
+            adversarial = 1;
+            break;
+        case 'b':
+            out_fmt = OUT_RECS;
+            break;
+        case 'z':
+            out_fmt = OUT_VARINT;
+            break;
+        case 'S':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    outpath = argv[optind];
+    if ((out = fopen(outpath, "wb")) == NULL)
+        fail("could not create", outpath);
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    /* Placeholder header; the counts are only known at the end */
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.flags = (out_fmt == OUT_VARINT) ? TRACE_VARINT : 0;
+    hdr.weight = 1;
+    write_header();
+
+    if (adversarial)
+        gen_adversarial();
+    else
+        gen_models();
+    while (live_len > 0)
+        block_free(live[live_len - 1]);
+
+    /* The suggested heap size is the peak of live payload bytes */
+    hdr.sugg_heapsize = (peak_bytes > INT32_MAX) ? INT32_MAX : peak_bytes;
+    if (fseek(out, 0, SEEK_SET) != 0)
+        fail("could not seek back to the header of", outpath);
+    write_header();
+    if (fclose(out) != 0)
+        fail("error writing", outpath);
+    fprintf(stderr, "tracegen: %" PRIu64 " requests, %" PRIu64
+            " blocks, peak %" PRIu64 " bytes live\n", hdr.num_ops,
+            hdr.num_ids, peak_bytes);
+    exit(0);
+}
@@ -0,0 +1,435 @@
+/*
+ * tstream.c - Read a trace a chunk at a time on a separate thread
+ *
+ * The reader thread fills a ring of TS_NBUF chunks and the caller takes
+ * them in order, so at most TS_NBUF chunks of the trace are in memory.
+ * Ids are mapped to slots by an open-addressed hash table that only the
+ * reader touches, and freed slots are handed out again last in, first
+ * out, which keeps the caller's block array dense and warm.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "tracefmt.h"
+#include "tstream.h"
+
+#define TS_NBUF     3        /* chunks in the ring */
+#define TS_IOBUF    (1<<20)  /* stdio buffer for the trace file */
+#define TS_EMPTY    SIZE_MAX /* slot of an unused hash table entry */
+#define MAXLINE     1024
+
+enum {TS_TEXT, TS_RECS, TS_VARINT};
+
+struct tstream {
+    FILE *fp;
+    char *path;
+    int fmt;                 /* TS_TEXT, TS_RECS or TS_VARINT */
+    uint64_t num_ops;        /* requests the header promises */
+    uint64_t pos;            /* requests read so far */
+    long lineno;             /* line of a text trace */
+
+    /* Live block ids and their slots; only the reader uses these */
+    uint64_t *ids;
+    size_t *slots;           /* TS_EMPTY where the entry is unused */
+    size_t mask;             /* table size - 1, a power of 2 minus 1 */
+    size_t live;             /* entries in use */
+    size_t *free_slots;      /* stack of slots whose block was freed */
+    size_t num_free, max_free;
+    size_t num_slots;        /* slots handed out so far */
+
+    /* The ring, shared with the caller under lock */
+    ts_chunk_t chunk[TS_NBUF];
+    int head;                /* next chunk the reader fills */
+    int tail;                /* next chunk the caller takes */
+    int count;               /* chunks filled and not yet handed back */
+    int held;                /* the caller has chunk[tail] */
+    int eof;                 /* the reader is done */
+    int stop;                /* ts_close wants the reader gone */
+    pthread_mutex_t lock;
+    pthread_cond_t filled, emptied;
+    pthread_t reader;
+};
+
+/*
+ * ts_error - Report a bad trace and exit
+ */
+static void ts_error(tstream_t *ts, const char *what)
+{
+    if (ts->fmt == TS_TEXT)
+        fprintf(stderr, "%s:%ld: %s\n", ts->path, ts->lineno, what);
+    else
+        fprintf(stderr, "%s: request %" PRIu64 ": %s\n", ts->path,
+                ts->pos, what);
+    exit(1);
+}
+
+static void *ts_alloc(size_t bytes)
+{
+    void *p;
+
+    if ((p = malloc(bytes)) == NULL) {
+        fprintf(stderr, "tstream: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*********************************************************
+ * Block id to slot map
+ ********************************************************/
+
+static inline size_t id_hash(tstream_t *ts, uint64_t id)
+{
+    return (size_t)((id * 0x9E3779B97F4A7C15ull) >> 17) & ts->mask;
+}
+
+/*
+ * id_find - Index of id in the table, or of the empty entry it would go in
+ */
+static size_t id_find(tstream_t *ts, uint64_t id)
+{
+    size_t i = id_hash(ts, id);
+
+    while (ts->slots[i] != TS_EMPTY && ts->ids[i] != id)
+        i = (i + 1) & ts->mask;
+    return i;
+}
+
+/*
+ * id_grow - Double the table
+ */
+static void id_grow(tstream_t *ts)
+{
+    uint64_t *ids = ts->ids;
+    size_t *slots = ts->slots;
+    size_t i, j, n = ts->mask + 1;
+
+    ts->mask = 2*n - 1;
+    ts->ids = ts_alloc(2*n * sizeof(uint64_t));
+    ts->slots = ts_alloc(2*n * sizeof(size_t));
+    for (i = 0; i < 2*n; i++)
+        ts->slots[i] = TS_EMPTY;
+    for (i = 0; i < n; i++) {
+        if (slots[i] != TS_EMPTY) {
+            j = id_find(ts, ids[i]);
+            ts->ids[j] = ids[i];
+            ts->slots[j] = slots[i];
+        }
+    }
+    free(ids);
+    free(slots);
+}
+
+/*
+ * id_delete - Empty entry i, moving later entries of its run back so
+ *     every remaining id is still found by a probe from its hash
+ */
+static void id_delete(tstream_t *ts, size_t i)
+{
+    size_t j = i, home;
+
+    for (;;) {
+        ts->slots[i] = TS_EMPTY;
+        do {
+            j = (j + 1) & ts->mask;
+            if (ts->slots[j] == TS_EMPTY)
+                return;
+            home = id_hash(ts, ts->ids[j]);
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        ts->ids[i] = ts->ids[j];
+        ts->slots[i] = ts->slots[j];
+        i = j;
+    }
+}
+
+/*
+ * map_op - Replace the id of a request by its slot
+ */
+static void map_op(tstream_t *ts, ts_op_t *op, uint64_t id)
+{
+    size_t i = id_find(ts, id);
+
+    switch (op->type) {
+    case TRACE_ALLOC:
+        if (ts->slots[i] != TS_EMPTY)
+            ts_error(ts, "block allocated twice");
+        op->slot = ts->num_free ? ts->free_slots[--ts->num_free]
+                                : ts->num_slots++;
+        ts->ids[i] = id;
+        ts->slots[i] = op->slot;
+        if (++ts->live > ts->mask / 2)
+            id_grow(ts);
+        break;
+
+    case TRACE_REALLOC:
+        if (ts->slots[i] == TS_EMPTY)
+            ts_error(ts, "realloc of a block that is not allocated");
+        op->slot = ts->slots[i];
+        break;
+
+    case TRACE_FREE:
+        if (ts->slots[i] == TS_EMPTY)
+            ts_error(ts, "free of a block that is not allocated");
+        op->slot = ts->slots[i];
+        id_delete(ts, i);
+        ts->live--;
+        if (ts->num_free == ts->max_free) {
+            ts->max_free = 2*ts->max_free + 1024;
+            ts->free_slots = realloc(ts->free_slots,
+                                     ts->max_free * sizeof(size_t));
+            if (ts->free_slots == NULL)
+                ts_error(ts, "out of memory");
+        }
+        ts->free_slots[ts->num_free++] = op->slot;
+        break;
+    }
+}
+
+/*********************************************************
+ * Parsing
+ ********************************************************/
+
+/*
+ * get_varint - Read a varint from the trace file
+ */
+static uint64_t get_varint(tstream_t *ts)
+{
+    uint64_t x = 0;
+    int shift, c;
+
+    for (shift = 0; shift < 70; shift += 7) {
+        if ((c = getc_unlocked(ts->fp)) == EOF)
+            ts_error(ts, "trace ends in the middle of a request");
+        x |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+            return x;
+    }
+    ts_error(ts, "bad varint");
+    return 0;
+}
+
+/*
+ * read_op - Read the next request; returns 0 at the end of the trace
+ */
+static int read_op(tstream_t *ts, ts_op_t *op, uint64_t *id)
+{
+    char line[MAXLINE], *s, *e;
+    trace_rec_t rec;
+    int c;
+
+    switch (ts->fmt) {
+    case TS_TEXT:
+        do {
+            if (fgets(line, MAXLINE, ts->fp) == NULL)
+                return 0;
+            ts->lineno++;
+            for (s = line; *s == ' ' || *s == '\t'; s++)
+                ;
+        } while (*s == '\n' || *s == '\0');
+        if (ts->pos == ts->num_ops)
+            ts_error(ts, "more requests than the header says");
+        switch (*s) {
+        case 'a': op->type = TRACE_ALLOC;   break;
+        case 'r': op->type = TRACE_REALLOC; break;
+        case 'f': op->type = TRACE_FREE;    break;
+        default:  ts_error(ts, "bogus type character");
+        }
+        *id = strtoull(s + 1, &e, 10);
+        if (e == s + 1)
+            ts_error(ts, "bad block id");
+        op->size = 0;
+        if (op->type != TRACE_FREE) {
+            s = e;
+            op->size = strtoull(s, &e, 10);
+            if (e == s)
+                ts_error(ts, "bad size");
+        }
+        return 1;
+
+    case TS_RECS:
+        if (ts->pos == ts->num_ops)
+            return 0;
+        if (fread(&rec, sizeof(rec), 1, ts->fp) != 1)
+            ts_error(ts, "trace ends early");
+        if (rec.type < TRACE_ALLOC || rec.type > TRACE_REALLOC)
+            ts_error(ts, "bad request type");
+        op->type = rec.type;
+        op->size = (op->type == TRACE_FREE) ? 0 : (size_t)rec.size;
+        *id = (uint32_t)rec.index;
+        return 1;
+
+    default: /* TS_VARINT */
+        if (ts->pos == ts->num_ops)
+            return 0;
+        if ((c = getc_unlocked(ts->fp)) == EOF)
+            ts_error(ts, "trace ends early");
+        if (c > TRACE_REALLOC)
+            ts_error(ts, "bad request type");
+        op->type = c;
+        *id = get_varint(ts);
+        op->size = (op->type == TRACE_FREE) ? 0 : get_varint(ts);
+        return 1;
+    }
+}
+
+/*
+ * fill - Read up to a chunk of requests into ch; returns how many
+ */
+static size_t fill(tstream_t *ts, ts_chunk_t *ch)
+{
+    uint64_t id;
+    size_t n;
+
+    ch->first = ts->pos;
+    for (n = 0; n < TS_CHUNK_OPS && read_op(ts, &ch->ops[n], &id); n++) {
+        map_op(ts, &ch->ops[n], id);
+        ts->pos++;
+    }
+    ch->num_ops = n;
+    ch->num_slots = ts->num_slots;
+    return n;
+}
+
+/*
+ * reader - The reader thread: fill chunks until the trace runs out
+ */
+static void *reader(void *arg)
+{
+    tstream_t *ts = arg;
+    size_t n;
+    int stop;
+
+    for (;;) {
+        pthread_mutex_lock(&ts->lock);
+        while (ts->count == TS_NBUF && !ts->stop)
+            pthread_cond_wait(&ts->emptied, &ts->lock);
+        stop = ts->stop;
+        pthread_mutex_unlock(&ts->lock);
+        if (stop)
+            break;
+
+        n = fill(ts, &ts->chunk[ts->head]);
+        if (n < TS_CHUNK_OPS && ts->fmt == TS_TEXT && ts->pos != ts->num_ops)
+            ts_error(ts, "fewer requests than the header says");
+
+        pthread_mutex_lock(&ts->lock);
+        if (n > 0) {
+            ts->head = (ts->head + 1) % TS_NBUF;
+            ts->count++;
+        }
+        if (n < TS_CHUNK_OPS)
+            ts->eof = 1;
+        pthread_cond_signal(&ts->filled);
+        pthread_mutex_unlock(&ts->lock);
+        if (n < TS_CHUNK_OPS)
+            break;
+    }
+    return NULL;
+}
+
+/*********************************************************
+ * Interface
+ ********************************************************/
+
+/*
+ * ts_open - Open path, read its header and start the reader thread
+ */
+tstream_t *ts_open(const char *path)
+{
+    tstream_t *ts = ts_alloc(sizeof(tstream_t));
+    trace_hdr_t hdr;
+    int32_t heap, weight;
+    size_t i;
+
+    memset(ts, 0, sizeof(tstream_t));
+    ts->path = strdup(path);
+    if ((ts->fp = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "Could not open %s in ts_open\n", path);
+        exit(1);
+    }
+    setvbuf(ts->fp, NULL, _IOFBF, TS_IOBUF);
+
+    if (fread(&hdr, sizeof(hdr), 1, ts->fp) == 1 &&
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+        ts->fmt = (hdr.flags & TRACE_VARINT) ? TS_VARINT : TS_RECS;
+        ts->num_ops = hdr.num_ops;
+    }
+    else {
+        ts->fmt = TS_TEXT;
+        rewind(ts->fp);
+        if (fscanf(ts->fp, "%" SCNd32 " %*u %" SCNu64 " %" SCNd32,
+                   &heap, &ts->num_ops, &weight) != 3)
+            ts_error(ts, "bad header");
+        ts->lineno = 3;  /* the first fgets finishes line 4 */
+    }
+
+    ts->mask = 1023;
+    ts->ids = ts_alloc((ts->mask + 1) * sizeof(uint64_t));
+    ts->slots = ts_alloc((ts->mask + 1) * sizeof(size_t));
+    for (i = 0; i <= ts->mask; i++)
+        ts->slots[i] = TS_EMPTY;
+    for (i = 0; i < TS_NBUF; i++)
+        ts->chunk[i].ops = ts_alloc(TS_CHUNK_OPS * sizeof(ts_op_t));
+
+    pthread_mutex_init(&ts->lock, NULL);
+    pthread_cond_init(&ts->filled, NULL);
+    pthread_cond_init(&ts->emptied, NULL);
+    if (pthread_create(&ts->reader, NULL, reader, ts) != 0) {
+        fprintf(stderr, "ts_open: could not start the reader thread\n");
+        exit(1);
+    }
+    return ts;
+}
+
+/*
+ * ts_next - Hand back the chunk from the last call, wait for the next
+ */
+ts_chunk_t *ts_next(tstream_t *ts)
+{
+    ts_chunk_t *ch = NULL;
+
+    pthread_mutex_lock(&ts->lock);
+    if (ts->held) {
+        ts->held = 0;
+        ts->tail = (ts->tail + 1) % TS_NBUF;
+        ts->count--;
+        pthread_cond_signal(&ts->emptied);
+    }
+    while (ts->count == 0 && !ts->eof)
+        pthread_cond_wait(&ts->filled, &ts->lock);
+    if (ts->count > 0) {
+        ts->held = 1;
+        ch = &ts->chunk[ts->tail];
+    }
+    pthread_mutex_unlock(&ts->lock);
+    return ch;
+}
+
+/*
+ * ts_close - Stop the reader thread and free everything
+ */
+void ts_close(tstream_t *ts)
+{
+    int i;
+
+    pthread_mutex_lock(&ts->lock);
+    ts->stop = 1;
+    pthread_cond_signal(&ts->emptied);
+    pthread_mutex_unlock(&ts->lock);
+    pthread_join(ts->reader, NULL);
+
+    pthread_mutex_destroy(&ts->lock);
+    pthread_cond_destroy(&ts->filled);
+    pthread_cond_destroy(&ts->emptied);
+    for (i = 0; i < TS_NBUF; i++)
+        free(ts->chunk[i].ops);
+    free(ts->ids);
+    free(ts->slots);
+    free(ts->free_slots);
+    free(ts->path);
+    fclose(ts->fp);
+    free(ts);
+}
@@ -0,0 +1,39 @@
+/*
+ * tstream.h - Read a trace a chunk at a time on a separate thread
+ *
+ * For traces too big to hold in memory. A reader thread parses the
+ * trace (.rep text or any binary form of tracefmt.h) into chunks of
+ * requests while the caller replays the chunk before. Block ids may be
+ * any 64-bit values; the reader renames each live block to a slot, a
+ * small integer that is reused once the block is freed, so the caller
+ * can keep its blocks in a plain array. Memory use is bounded by the
+ * most blocks live at once, not by the length of the trace.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#define TS_CHUNK_OPS  (64*1024)  /* requests per chunk */
+
+typedef struct {
+    int type;     /* TRACE_ALLOC, TRACE_FREE or TRACE_REALLOC */
+    size_t slot;  /* stands in for the block id */
+    size_t size;  /* payload bytes; 0 for a free */
+} ts_op_t;
+
+typedef struct {
+    ts_op_t *ops;     /* requests in trace order */
+    size_t num_ops;   /* number of them, up to TS_CHUNK_OPS */
+    size_t num_slots; /* every slot used so far is below this */
+    uint64_t first;   /* trace position of ops[0] */
+} ts_chunk_t;
+
+typedef struct tstream tstream_t;
+
+/* Open path and start reading it; exits with a message on errors */
+tstream_t *ts_open(const char *path);
+
+/* Hand back the previous chunk and wait for the next; NULL at the end */
+ts_chunk_t *ts_next(tstream_t *ts);
+
+/* Stop the reader and free the stream */
+void ts_close(tstream_t *ts);